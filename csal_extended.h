@@ -6,7 +6,11 @@
 #include "threads_list.h"
 #include "safe_circular_queue.h"
 #include "local_eventqueue.h"
+#include "event_payload_pool.h"
 #include "event_management.h"
+#include "event_static_routes.h"
+#include "event_record.h"
+#include "event_shm.h"
 #include "lp_workqueue.h"
 #include "os_quick_fft.h"
 #include "os_cli.h"
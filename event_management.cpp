@@ -1,10 +1,25 @@
 #include "event_management.h"
 #include "stdlib.h"
+#include "string.h"
 #include "global_includes.h"
+#include "unit_check.h"
 
 #ifndef OS_EVENTQUEUE
 #define PUBLISH_EVENT_QUEUE_MAX_SIZE 16
 #define PER_QUEUE_MAX_SIZE 16
+// Deliveries a dispatcher has room for up front, grows past it for groups with a bigger fan out
+#define EVENT_GROUP_INIT_DELIVERIES 64
+
+#if EVENT_PUBLISH_GROUP_MAX > PUBLISH_EVENT_QUEUE_MAX_SIZE
+#error "EVENT_PUBLISH_GROUP_MAX has to fit in the publish queue"
+#endif
+
+// Subscriber queue entry is only a marker, the value lives in the subscription's coalesce_latest
+#define EVENT_MSG_FLAG_COALESCED (1 << 0)
+// Publish queue entry that only wakes the dispatcher up to reclaim removed subscribers
+#define EVENT_MSG_FLAG_SWEEP (1 << 1)
+// Came in from another process, forward hooks skip it
+#define EVENT_MSG_FLAG_REMOTE (1 << 2)
 
 // #define EVENT_MANAGEMENT_DEBUGGING
 #ifdef EVENT_MANAGEMENT_DEBUGGING
@@ -13,337 +28,2148 @@
 #define event_management_println(e) (void)e
 #endif
 
-static os_mut_t event_queue_head_mut;
-static event_type_queue_ll_t *event_queue_head = NULL;
-static bool inited = false;
-safe_circular_queue_t publish_event_queue;
+/**
+ * @brief Where a dispatcher collects local eventqueue deliveries while it works through a publish_events group,
+ * so every queue gets it's share of the group in one piece
+ */
+typedef struct event_group_delivery_t
+{
+    local_event_queue_t *queue;
+    event_msg_t *msg;
+} event_group_delivery_t;
 
-void event_management_init(void *params)
+typedef struct event_group_t
 {
-    int num_events = EVENT_TYPE_EVENT_END;
+    event_msg_t msgs[EVENT_PUBLISH_GROUP_MAX];
+    int num_msgs;
+    event_group_delivery_t *deliveries;
+    int num_deliveries;
+    int max_deliveries;
+    // Where one queue's share gets gathered, same size as deliveries
+    event_msg_t *batch;
+} event_group_t;
 
-    event_queue_head = (event_type_queue_ll_t *)malloc(sizeof(event_type_queue_ll_t));
-    event_type_queue_ll_t *node = event_queue_head;
+typedef struct event_dispatcher_shard_t
+{
+    // Lock around the subscriber and callback lists of every event type owned by this shard
+    os_mut_t shard_mut;
+    // Events published to this shard waiting to be dispatched, one queue per priority lane
+    safe_circular_queue_t publish_event_queue[EVENT_NUM_PRIORITY_LANES];
+    // Set whenever anything lands in any of the lanes
+    os_setbits_t publish_signal;
+    // Something in this shard got unsubscribed/detached and is waiting to be reclaimed, guarded by shard_mut
+    bool sweep_pending;
+    // Only ever touched by the shard's own dispatcher
+    event_group_t group;
+} event_dispatcher_shard_t;
 
-    // Generate linked list to iterate through when publishing/subscribing events
-    for (int n = 0; n < num_events; n++)
+// Async callbacks that have events waiting in their mailbox, each one at most once
+static safe_circular_queue_t cb_run_queue;
+// Guards the scheduled flag of every async callback
+static os_mut_t cb_executor_mut;
+static int num_async_cbs = 0;
+
+// Allocated as one block so looking up an event type is just an index
+static event_type_queue_ll_t *event_queue_head = NULL;
+static event_dispatcher_shard_t event_shards[EVENT_MANAGEMENT_NUM_DISPATCHERS];
+static bool inited = false;
+// Set once the first dispatcher starts, after that the shard of a type can't move anymore
+static bool dispatchers_running = false;
+// Optional observer of every dispatched event, ctx is written before tap is published
+static event_tap_t event_tap = NULL;
+static void *event_tap_ctx = NULL;
+// Routing table fixed at compile time, read without locks
+static const event_static_route_t *static_routes = NULL;
+static const uint16_t *static_route_index = NULL;
+
+/**
+ * @brief The event_data_t a callback or filter sees, inline payloads point into msg
+ */
+static inline event_data_t event_msg_view(event_msg_t *msg)
+{
+    event_data_t data = msg->data;
+    if (msg->inline_len > 0)
     {
-        node->event_id = (event_type_t)n;
-        node->local_event_queue_head = NULL;
-        node->event_cb_queue_head = NULL;
-        node->next = (event_type_queue_ll_t *)malloc(sizeof(event_type_queue_ll_t));
-        node = node->next;
-        event_management_println("Event generated initialized");
+        data.data_ptr = msg->inline_data.bytes;
     }
+    return data;
+}
 
-    // NULL terminater
-    node->next = NULL;
+static inline event_type_queue_ll_t *event_type_node(int event)
+{
+    if (event < 0 || event >= EVENT_TYPE_EVENT_END)
+    {
+        return NULL;
+    }
 
-    // Generate and clear the mutex around the entire mutex list
-    os_mut_init(&event_queue_head_mut);
-    os_mut_exit(&event_queue_head_mut);
+    return &event_queue_head[event];
+}
 
-    if (safe_circular_queue_init(&publish_event_queue, PUBLISH_EVENT_QUEUE_MAX_SIZE, sizeof(event_data_t)) != OS_RET_OK)
+void event_trace_hist_record(event_trace_hist_t *hist, uint32_t us)
+{
+    int bucket = 0;
+    if (us > 0)
     {
-        event_management_println((char *)"Circular Queue Failed to initialize");
+        bucket = 32 - __builtin_clz(us);
+        if (bucket >= EVENT_TRACE_NUM_BUCKETS)
+        {
+            bucket = EVENT_TRACE_NUM_BUCKETS - 1;
+        }
     }
 
-    inited = true;
+    __atomic_fetch_add(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    uint32_t max_us = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+    while (us > max_us && !__atomic_compare_exchange_n(&hist->max_us, &max_us, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
 }
 
-int attach_event(event_type_t event, event_cb_t event_cb)
+/**
+ * @brief Upper bound of the bucket that holds the given percentile, clamped to the max we actually saw
+ */
+static uint32_t trace_percentile(const uint32_t *buckets, uint32_t count, uint32_t max_us, int percentile)
 {
-    if (inited == false)
+    if (count == 0)
     {
-        return OS_RET_NOT_INITIALIZED;
+        return 0;
     }
 
-    event_management_println("Subscribing to event");
-    // Iterate through eventlist to find the correct event
-    // We need to subscribe to
-    event_type_queue_ll_t *node = event_queue_head;
-    while (node != NULL && node->event_id != event)
+    uint64_t target = ((uint64_t)count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (int n = 0; n < EVENT_TRACE_NUM_BUCKETS; n++)
     {
-        node = node->next;
+        seen += buckets[n];
+        if (seen >= target)
+        {
+            uint32_t upper = n == 0 ? 0 : (uint32_t)((1ULL << n) - 1);
+            return upper < max_us ? upper : max_us;
+        }
     }
+    return max_us;
+}
 
-    // How you got here idk, there should be a list for every event
-    if (node == NULL)
+void event_trace_hist_stats(event_trace_hist_t *hist, event_trace_stats_t *stats)
+{
+    // Snapshot first, so the percentiles at least agree with each other
+    uint32_t buckets[EVENT_TRACE_NUM_BUCKETS];
+    uint32_t count = 0;
+    for (int n = 0; n < EVENT_TRACE_NUM_BUCKETS; n++)
     {
-        event_management_println("Couldn't find correct node for event");
-        return OS_RET_INT_ERR;
+        buckets[n] = __atomic_load_n(&hist->buckets[n], __ATOMIC_RELAXED);
+        count += buckets[n];
     }
 
-    event_management_println("Found correct node for event");
+    stats->count = count;
+    stats->max_us = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+    stats->p50_us = trace_percentile(buckets, count, stats->max_us, 50);
+    stats->p99_us = trace_percentile(buckets, count, stats->max_us, 99);
+}
 
-    os_mut_entry_wait_indefinite(&event_queue_head_mut);
-    // First item in list created.
-    if (node->event_cb_queue_head == NULL)
+#ifdef EVENT_MANAGEMENT_TRACING
+/**
+ * @brief Bumps a high water mark gauge
+ */
+static void trace_gauge(uint32_t *gauge, uint32_t value)
+{
+    uint32_t max = __atomic_load_n(gauge, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(gauge, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        node->event_cb_queue_head = (event_cb_ll_t *)malloc(sizeof(event_cb_ll_t));
-        node->event_cb_queue_head->event_cb = event_cb;
-        node->event_cb_queue_head->next = NULL;
-        event_management_println("First node in list");
     }
-    else
+}
+
+static void trace_clear(event_trace_hist_t *hist)
+{
+    for (int n = 0; n < EVENT_TRACE_NUM_BUCKETS; n++)
+    {
+        __atomic_store_n(&hist->buckets[n], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&hist->max_us, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records how long events sat in a subscriber queue, once they're handed out
+ */
+static void trace_consumed(local_event_queue_t *queue, event_msg_t *msgs, int num_msgs)
+{
+    uint32_t now_us = EVENT_TRACE_TIME_US();
+    for (int n = 0; n < num_msgs; n++)
     {
-        // Otherwise we iterate through the list
-        event_cb_ll_t *local_node = node->event_cb_queue_head;
-        while (local_node->next != NULL)
+        event_type_queue_ll_t *node = event_type_node(msgs[n].data.event_id);
+        if (node == NULL)
         {
-            event_management_println("Not first node .. iterating...");
-            // If it's already in the list we return out
-            if (local_node->event_cb == event_cb)
-            {
-                os_mut_exit(&event_queue_head_mut);
-                return OS_RET_ALREADY_INITED;
-            }
-            local_node = local_node->next;
+            continue;
         }
 
-        event_management_println("First node in list");
-        local_node->next = (event_cb_ll_t *)malloc(sizeof(event_cb_ll_t));
-        local_node = local_node->next;
-        // Populate with our local eventqueue
-        local_node->event_cb = event_cb;
-        // NULL terminate
-        local_node->next = NULL;
+        event_trace_hist_record(&node->trace.stages[EVENT_TRACE_DISPATCH_TO_CONSUME], now_us - msgs[n].dispatch_us);
+        event_trace_hist_record(&node->trace.stages[EVENT_TRACE_PUBLISH_TO_CONSUME], now_us - msgs[n].publish_us);
+        if (queue != NULL)
+        {
+            event_trace_hist_record(&queue->consume_latency, now_us - msgs[n].dispatch_us);
+        }
     }
-    // Exit lock
-    os_mut_exit(&event_queue_head_mut);
-    return OS_RET_OK;
 }
+#endif
 
-int subscribe_event(local_event_queue_t *local_eventqueue, event_type_t event)
+/**
+ * @brief Puts an event into the right lane of a subscriber queue and wakes up the consumer
+ * @param bool block whether we wait for room in a full lane, or give up with OS_RET_LOW_MEM_ERROR
+ */
+static int local_eventqueue_push(local_event_queue_t *queue, event_msg_t *msg, bool block)
 {
-    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    safe_circular_queue_t *lane = &queue->event_queue[msg->lane];
+    int ret;
+    if (block)
     {
-        return OS_RET_NOT_INITIALIZED;
+        ret = safe_circular_enqueue_notimeout(lane, sizeof(event_msg_t), msg);
     }
-
-    if (inited == false)
+    else
     {
-        return OS_RET_NOT_INITIALIZED;
+        ret = safe_circular_enqueue(lane, sizeof(event_msg_t), msg);
     }
 
-    if (local_eventqueue == NULL)
+    if (ret == OS_RET_OK)
     {
-        return OS_RET_INVALID_PARAM;
+        os_setbits_signal(&queue->event_signal, 1);
+#ifdef EVENT_MANAGEMENT_TRACING
+        uint32_t depth = safe_circular_queue_count(lane);
+        trace_gauge(&queue->depth_max, depth);
+        event_type_queue_ll_t *node = event_type_node(msg->data.event_id);
+        if (node != NULL)
+        {
+            trace_gauge(&node->trace.subscriber_depth_max, depth);
+        }
+#endif
     }
+    return ret;
+}
 
-    event_management_println("Subscribing to event");
-    // Iterate through eventlist to find the correct event
-    // We need to subscribe to
-    event_type_queue_ll_t *node = event_queue_head;
-    while (node != NULL && node->event_id != event)
+/**
+ * @brief Puts an event into the right lane of a shard's publish queue and wakes up the dispatcher
+ */
+static int shard_push(event_dispatcher_shard_t *shard, event_msg_t *msg, bool block)
+{
+    safe_circular_queue_t *lane = &shard->publish_event_queue[msg->lane];
+    int ret;
+    if (block)
     {
-        node = node->next;
+        ret = safe_circular_enqueue_notimeout(lane, sizeof(event_msg_t), msg);
     }
-
-    // How you got here idk, there should be a list for every event
-    if (node == NULL)
+    else
     {
-        event_management_println("Couldn't find correct node for event");
-        return OS_RET_INT_ERR;
+        ret = safe_circular_enqueue(lane, sizeof(event_msg_t), msg);
     }
 
-    event_management_println("Found correct node for event");
+    if (ret == OS_RET_OK)
+    {
+        os_setbits_signal(&shard->publish_signal, 1);
+    }
+    return ret;
+}
 
-    os_mut_entry_wait_indefinite(&event_queue_head_mut);
-    // First item in list created.
-    if (node->local_event_queue_head == NULL)
+/**
+ * @brief Puts a whole publish_events group into it's lane with one lock and one wakeup
+ */
+static int shard_push_group(event_dispatcher_shard_t *shard, event_msg_t *msgs, int num_msgs)
+{
+    int ret = safe_circular_enqueue_batch_notimeout(&shard->publish_event_queue[msgs[0].lane], sizeof(event_msg_t), msgs, num_msgs);
+    if (ret == OS_RET_OK)
     {
-        node->local_event_queue_head = (local_event_queue_ll_t *)malloc(sizeof(local_event_queue_ll_t));
-        node->local_event_queue_head->queue = local_eventqueue;
-        node->local_event_queue_head->next = NULL;
-        event_management_println("First node in list");
+        os_setbits_signal(&shard->publish_signal, 1);
     }
-    else
+    return ret;
+}
+
+/**
+ * @brief Puts events that all share a lane into a subscriber queue back to back, then wakes up the consumer
+ * @note Falls back to one at a time if there are more than the lane could ever hold
+ */
+static void local_eventqueue_push_group(local_event_queue_t *queue, event_msg_t *msgs, int num_msgs)
+{
+    if (num_msgs == 1 || safe_circular_enqueue_batch_notimeout(&queue->event_queue[msgs[0].lane], sizeof(event_msg_t), msgs, num_msgs) != OS_RET_OK)
     {
-        // Otherwise we iterate through the list
-        local_event_queue_ll_t *local_node = node->local_event_queue_head;
-        while (local_node->next != NULL)
+        for (int n = 0; n < num_msgs; n++)
         {
-            event_management_println("Not first node .. iterating...");
-            // If it's already in the list we return out
-            if (local_node->queue == local_eventqueue)
-            {
-                os_mut_exit(&event_queue_head_mut);
-                return OS_RET_ALREADY_INITED;
-            }
-            local_node = local_node->next;
+            local_eventqueue_push(queue, &msgs[n], true);
         }
+        return;
+    }
 
-        event_management_println("First node in list");
-        local_node->next = (local_event_queue_ll_t *)malloc(sizeof(local_event_queue_ll_t));
-        local_node = local_node->next;
-        // Populate with our local eventqueue
-        local_node->queue = local_eventqueue;
-        // NULL terminate
-        local_node->next = NULL;
+    os_setbits_signal(&queue->event_signal, 1);
+#ifdef EVENT_MANAGEMENT_TRACING
+    uint32_t depth = safe_circular_queue_count(&queue->event_queue[msgs[0].lane]);
+    trace_gauge(&queue->depth_max, depth);
+    for (int n = 0; n < num_msgs; n++)
+    {
+        event_type_queue_ll_t *node = event_type_node(msgs[n].data.event_id);
+        if (node != NULL)
+        {
+            trace_gauge(&node->trace.subscriber_depth_max, depth);
+        }
     }
-    // Exit lock
-    os_mut_exit(&event_queue_head_mut);
-    return OS_RET_OK;
+#endif
 }
 
-local_event_queue_t *new_local_eventqueue(int num_elements_queue)
+/**
+ * @brief Hands out every delivery collected so far, a queue's share of the group in one piece
+ */
+static void group_flush(event_group_t *group)
 {
-    local_event_queue_t *queue = (local_event_queue_t *)malloc(sizeof(local_event_queue_t));
-    queue->eventqueue_status = OS_STATUS_INITIALIZED;
-
-    int ret = os_mut_init(&queue->local_queue_mutex);
-    if (ret != OS_RET_OK)
+    event_msg_t *batch = group->batch;
+    for (int n = 0; n < group->num_deliveries; n++)
     {
-        event_management_println("Wasn't able to initialize another eventqueue mutex");
-        queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
-        return queue;
+        local_event_queue_t *queue = group->deliveries[n].queue;
+        if (queue == NULL)
+        {
+            continue;
+        }
+
+        // Deliveries were collected in event order, so this keeps the group's order
+        int num = 0;
+        for (int k = n; k < group->num_deliveries; k++)
+        {
+            if (group->deliveries[k].queue != queue)
+            {
+                continue;
+            }
+
+            batch[num++] = *group->deliveries[k].msg;
+            group->deliveries[k].queue = NULL;
+        }
+        local_eventqueue_push_group(queue, batch, num);
     }
+    group->num_deliveries = 0;
+}
 
-    os_mut_exit(&queue->local_queue_mutex);
-    if (num_elements_queue == 0)
+/**
+ * @brief Makes room for more deliveries, only ever called by the shard's own dispatcher
+ */
+static int group_grow(event_group_t *group, int max_deliveries)
+{
+    event_group_delivery_t *deliveries = (event_group_delivery_t *)realloc(group->deliveries, sizeof(event_group_delivery_t) * max_deliveries);
+    if (deliveries == NULL)
     {
-        num_elements_queue = PER_QUEUE_MAX_SIZE;
+        return OS_RET_LOW_MEM_ERROR;
     }
+    group->deliveries = deliveries;
 
-    ret = safe_circular_queue_init(&queue->event_queue, num_elements_queue, sizeof(event_data_t));
-    if (ret != OS_RET_OK)
+    event_msg_t *batch = (event_msg_t *)realloc(group->batch, sizeof(event_msg_t) * max_deliveries);
+    if (batch == NULL)
     {
-        event_management_println("Wasn't able to initialize another eventqueue circular queue");
-        queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
-        return queue;
+        return OS_RET_LOW_MEM_ERROR;
     }
-    return queue;
+    group->batch = batch;
+    group->max_deliveries = max_deliveries;
+    return OS_RET_OK;
 }
 
-int publish_event(int event, void *ptr)
+/**
+ * @brief Delivers an event into a local eventqueue, held back until the rest of it's group got dispatched
+ */
+static void group_deliver(event_group_t *group, local_event_queue_t *queue, event_msg_t *msg)
 {
-    if (event > EVENT_TYPE_EVENT_END)
+    // Plain single events go straight in
+    if (group->num_msgs == 1)
     {
-        return OS_RET_INVALID_PARAM;
+        local_eventqueue_push(queue, msg, true);
+        return;
     }
 
-    event_data_t data = {
-        .event_id = (event_type_t)event,
-        .data_ptr = ptr};
-
-    // Enqueue to our global eventqueue
-    int ret = safe_circular_enqueue_notimeout(&publish_event_queue, sizeof(event_data_t), &data);
-    if (ret != OS_RET_OK)
+    // Bigger fan out than we've seen so far, grow instead of splitting the group up
+    if (group->num_deliveries == group->max_deliveries)
     {
-        return ret;
+        int max_deliveries = group->max_deliveries > 0 ? group->max_deliveries * 2 : EVENT_GROUP_INIT_DELIVERIES;
+        if (group_grow(group, max_deliveries) != OS_RET_OK)
+        {
+            // Out of memory, the group still arrives in order, just not in one piece
+            event_management_println("Couldn't grow group deliveries");
+            group_flush(group);
+            local_eventqueue_push(queue, msg, true);
+            return;
+        }
     }
 
-    return OS_RET_OK;
+    group->deliveries[group->num_deliveries].queue = queue;
+    group->deliveries[group->num_deliveries].msg = msg;
+    group->num_deliveries++;
 }
 
-void event_management_thread(void *parameters)
+/**
+ * @brief Grabs up to max_msgs out of a set of lanes, highest priority lane first
+ * @param os_setbits_t *signal set by whoever pushes into any of the lanes
+ * @note Each lane has it's own lock, a batch takes the lock of every non-empty lane it drains once
+ * @return number of messages, 0 if we timed out
+ */
+static int lanes_pop(safe_circular_queue_t *lanes, os_setbits_t *signal, event_msg_t *msgs, int max_msgs, uint32_t timeout_ms)
 {
+    uint64_t deadline_ms = get_current_time_millis() + timeout_ms;
     for (;;)
     {
+        int num = 0;
+        for (int lane = EVENT_NUM_PRIORITY_LANES - 1; lane >= 0 && num < max_msgs; lane--)
+        {
+            // Empty lanes don't cost a lock, so a batch out of one lane is one lock no matter how many lanes there are
+            if (safe_circular_queue_count(&lanes[lane]) == 0)
+            {
+                continue;
+            }
 
-    begining:
-
-        event_data_t data;
-        // Sit and wait until we get data
-        safe_circular_dequeue_notimeout(&publish_event_queue, sizeof(data), &data);
-        event_management_println("Got an event from queue");
+            int ret = safe_circular_dequeue_batch_timeout(&lanes[lane], sizeof(event_msg_t), &msgs[num], max_msgs - num, 0);
+            if (ret > 0)
+            {
+                num += ret;
+            }
+        }
 
-        os_mut_entry_wait_indefinite(&event_queue_head_mut);
-        // Find the correct event that we just got published
-        event_type_queue_ll_t *node = event_queue_head;
+        if (num > 0 || timeout_ms == 0)
+        {
+            return num;
+        }
 
-        while (node != NULL)
+        int ret;
+        if (timeout_ms == EVENT_WAIT_FOREVER)
+        {
+            ret = os_waitbits_indefinite(signal, 1);
+        }
+        else
         {
-            if (node->event_id == data.event_id)
+            uint64_t now_ms = get_current_time_millis();
+            if (now_ms >= deadline_ms)
             {
-                event_management_println("Found correct event");
-                break;
+                return 0;
             }
+            ret = os_waitbits(signal, 1, deadline_ms - now_ms);
+        }
 
-            node = node->next;
+        if (ret == OS_RET_TIMEOUT)
+        {
+            return 0;
+        }
+        if (ret != OS_RET_OK)
+        {
+            return ret;
         }
 
-        // If we somehow couldn't find anyone subcribed to those events
-        if (node == NULL)
+        // Cleared before we look again, so anything pushed after this sets it right back
+        os_clearbits(signal, 1);
+    }
+}
+
+/**
+ * @brief Swaps every coalesced marker in a batch for the newest value of it's subscription
+ * @note If the subscription was already reclaimed by the dispatcher, the marker was the last thing
+ * holding on to it, so we free it here
+ */
+static void resolve_coalesced(local_event_queue_t *queue, event_msg_t *msgs, int num_msgs)
+{
+    local_event_queue_ll_t *orphans = NULL;
+    bool locked = false;
+
+    for (int n = 0; n < num_msgs; n++)
+    {
+        if ((msgs[n].flags & EVENT_MSG_FLAG_COALESCED) == 0)
         {
-            os_mut_exit(&event_queue_head_mut);
-            goto begining;
+            continue;
         }
 
-        // Iterated through all subscribed lists of that head
-        // And add the event to their own localized eventqueue
-        local_event_queue_ll_t *head = node->local_event_queue_head;
+        // One lock for the whole batch, and none at all if there are no markers
+        if (locked == false)
+        {
+            os_mut_entry_wait_indefinite(&queue->local_queue_mutex);
+            locked = true;
+        }
 
-        os_mut_exit(&event_queue_head_mut);
-        while (head != NULL)
+        local_event_queue_ll_t *sub_node = (local_event_queue_ll_t *)msgs[n].data.data_ptr;
+        msgs[n] = sub_node->coalesce_latest;
+        sub_node->coalesce_pending = false;
+        if (sub_node->orphaned)
         {
-            os_mut_entry_wait_indefinite(&head->queue->local_queue_mutex);
-            safe_circular_enqueue_notimeout(&head->queue->event_queue, sizeof(data), &data);
-            event_management_println("Submitting event to local queue");
-            os_mut_exit(&head->queue->local_queue_mutex);
-            head = head->next;
+            sub_node->orphan_next = orphans;
+            orphans = sub_node;
         }
+    }
+
+    if (locked)
+    {
+        os_mut_exit(&queue->local_queue_mutex);
+    }
 
-        event_cb_ll_t *cb_head = node->event_cb_queue_head;
-        while (cb_head != NULL)
+    while (orphans != NULL)
+    {
+        local_event_queue_ll_t *next = orphans->orphan_next;
+        free(orphans);
+        orphans = next;
+    }
+}
+
+/**
+ * @brief Throws away everything sitting in a subscriber queue without blocking, dropping payload references
+ */
+static void drain_local_eventqueue(local_event_queue_t *queue)
+{
+    event_msg_t msg;
+    for (int lane = 0; lane < EVENT_NUM_PRIORITY_LANES; lane++)
+    {
+        while (safe_circular_dequeue(&queue->event_queue[lane], sizeof(msg), &msg) == OS_RET_OK)
         {
-            cb_head->event_cb(data);
-            cb_head = cb_head->next;
+            resolve_coalesced(queue, &msg, 1);
+            if (msg.inline_len == 0)
+            {
+                release_event(msg.data);
+            }
         }
     }
 }
 
-int subscribe_eventlist(local_event_queue_t *local_eventqueue, int *event_list, int num_events, int event_length_max)
+/**
+ * @brief Drops a reference to a local eventqueue, the queue's memory is freed with the last one
+ * @note The owner holds one reference until delete_local_eventqueue, every linked subscription holds another
+ */
+static void local_eventqueue_release(local_event_queue_t *queue)
 {
-    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    if (__atomic_sub_fetch(&queue->refs, 1, __ATOMIC_ACQ_REL) > 0)
     {
-        return OS_RET_NOT_INITIALIZED;
+        return;
     }
-    for (int n = 0; n < num_events; n++)
+
+    drain_local_eventqueue(queue);
+    for (int lane = 0; lane < EVENT_NUM_PRIORITY_LANES; lane++)
     {
-        event_management_println("subcribed event in list");
-        int ret = subscribe_event(local_eventqueue, (event_type_t)event_list[n]);
-        if (ret != OS_RET_OK)
+        safe_circular_deinit(&queue->event_queue[lane]);
+    }
+    os_setbits_deconstruct(&queue->event_signal);
+    os_mut_deinit(&queue->local_queue_mutex);
+    if (queue->static_storage == false)
+    {
+        free(queue->landing);
+        free(queue);
+    }
+}
+
+/**
+ * @brief Frees a subscription that has been unlinked from it's event type
+ * @note Called by the dispatcher that owns the event type, so nothing else is walking it anymore
+ */
+static void reclaim_sub_node(local_event_queue_ll_t *sub_node)
+{
+    local_event_queue_t *queue = sub_node->queue;
+
+    // A coalesced marker still in the queue points at us, let the consumer free us when it gets there
+    os_mut_entry_wait_indefinite(&queue->local_queue_mutex);
+    bool pending = sub_node->coalesce_pending;
+    sub_node->orphaned = pending;
+    os_mut_exit(&queue->local_queue_mutex);
+
+    if (pending == false)
+    {
+        free(sub_node);
+    }
+
+    local_eventqueue_release(queue);
+}
+
+/**
+ * @brief Frees an async callback's mailbox and the callback itself
+ */
+static void destroy_async_cb(event_cb_ll_t *cb_node)
+{
+    event_msg_t msg;
+    while (safe_circular_dequeue(&cb_node->mailbox, sizeof(msg), &msg) == OS_RET_OK)
+    {
+        if (msg.inline_len == 0)
         {
-            return ret;
+            release_event(msg.data);
         }
     }
-    return OS_RET_OK;
+    safe_circular_deinit(&cb_node->mailbox);
+    free(cb_node);
 }
 
-bool available_events(local_event_queue_t *local_eventqueue)
+/**
+ * @brief Frees a callback that has been unlinked from it's event type
+ * @note An async callback a worker currently owns gets freed by that worker once it's done with it
+ */
+static void reclaim_cb_node(event_cb_ll_t *cb_node)
 {
-    if (local_eventqueue == NULL)
+    if (cb_node->async == false)
     {
-        return false;
+        free(cb_node);
+        return;
     }
 
-    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    os_mut_entry_wait_indefinite(&cb_executor_mut);
+    bool busy = __atomic_load_n(&cb_node->scheduled, __ATOMIC_ACQUIRE);
+    cb_node->orphaned = busy;
+    if (busy == false)
     {
-        return false;
+        num_async_cbs--;
     }
+    os_mut_exit(&cb_executor_mut);
 
-    return (local_eventqueue->event_queue.num_elements_in_queue > 0);
+    if (busy == false)
+    {
+        destroy_async_cb(cb_node);
+    }
 }
 
-event_data_t consume_event(local_event_queue_t *local_eventqueue)
+/**
+ * @brief Lets a shard's dispatcher know it has removed nodes to reclaim
+ * @note Called with the shard lock held
+ */
+static void request_sweep(int shard_index)
 {
-    event_data_t data;
-    data.data_ptr = NULL;
-    data.event_id = EVENT_NONE;
+    event_dispatcher_shard_t *shard = &event_shards[shard_index];
+    if (shard->sweep_pending)
+    {
+        return;
+    }
+    shard->sweep_pending = true;
 
-    if (local_eventqueue == NULL)
+    // Wake up an idle dispatcher. If the publish queue is full it's busy anyways and sweeps after the next event
+    event_msg_t msg;
+    msg.data.event_id = EVENT_NONE;
+    msg.data.data_ptr = NULL;
+    msg.inline_len = 0;
+    msg.flags = EVENT_MSG_FLAG_SWEEP;
+    msg.lane = 0;
+    msg.group_len = 0;
+    shard_push(shard, &msg, false);
+}
+
+/**
+ * @brief Unlinks and frees every removed subscriber and callback of the event types a shard owns
+ * @note Only ever run on that shard's dispatcher, between events, since it's the one thing walking
+ * the lists without the lock. That's what makes freeing the nodes safe
+ */
+static void sweep_shard(int shard_index)
+{
+    event_dispatcher_shard_t *shard = &event_shards[shard_index];
+    local_event_queue_ll_t *dead_subs = NULL;
+    event_cb_ll_t *dead_cbs = NULL;
+
+    os_mut_entry_wait_indefinite(&shard->shard_mut);
+    if (shard->sweep_pending == false)
     {
-        return data;
+        os_mut_exit(&shard->shard_mut);
+        return;
     }
+    shard->sweep_pending = false;
 
-    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    for (int n = 0; n < EVENT_TYPE_EVENT_END; n++)
+    {
+        event_type_queue_ll_t *node = &event_queue_head[n];
+        if (node->shard != shard_index)
+        {
+            continue;
+        }
+
+        local_event_queue_ll_t **sub_link = &node->local_event_queue_head;
+        while (*sub_link != NULL)
+        {
+            local_event_queue_ll_t *sub_node = *sub_link;
+            if (__atomic_load_n(&sub_node->removed, __ATOMIC_ACQUIRE))
+            {
+                *sub_link = sub_node->next;
+                sub_node->next = dead_subs;
+                dead_subs = sub_node;
+                continue;
+            }
+            sub_link = &sub_node->next;
+        }
+
+        event_cb_ll_t **cb_link = &node->event_cb_queue_head;
+        while (*cb_link != NULL)
+        {
+            event_cb_ll_t *cb_node = *cb_link;
+            if (__atomic_load_n(&cb_node->removed, __ATOMIC_ACQUIRE))
+            {
+                *cb_link = cb_node->next;
+                cb_node->next = dead_cbs;
+                dead_cbs = cb_node;
+                continue;
+            }
+            cb_link = &cb_node->next;
+        }
+    }
+    os_mut_exit(&shard->shard_mut);
+
+    // Unlinked, so now they can go outside the lock
+    while (dead_subs != NULL)
     {
-        return data;
+        local_event_queue_ll_t *next = dead_subs->next;
+        reclaim_sub_node(dead_subs);
+        dead_subs = next;
     }
 
-    safe_circular_dequeue_notimeout(&local_eventqueue->event_queue, sizeof(data), &data);
-    return data;
+    while (dead_cbs != NULL)
+    {
+        event_cb_ll_t *next = dead_cbs->next;
+        reclaim_cb_node(dead_cbs);
+        dead_cbs = next;
+    }
 }
+
+/**
+ * @brief Runs the subscriber's filter
+ * @return true if the subscriber doesn't want this event
+ */
+static inline bool subscriber_filtered(local_event_queue_ll_t *sub_node, event_msg_t *msg)
+{
+    if (sub_node->filter == NULL)
+    {
+        return false;
+    }
+
+    event_data_t data = event_msg_view(msg);
+    return sub_node->filter(&data, sub_node->filter_ctx) == false;
+}
+
+/**
+ * @brief Hands a latest-value event to a subscriber
+ * @note If the subscriber still has one of these pending we overwrite it in place,
+ * otherwise a marker gets queued that consume_event swaps for the newest value
+ */
+static void deliver_coalesced(local_event_queue_ll_t *sub_node, event_msg_t *msg)
+{
+    event_msg_t replaced;
+    bool was_pending;
+
+    os_mut_entry_wait_indefinite(&sub_node->queue->local_queue_mutex);
+    was_pending = sub_node->coalesce_pending;
+    replaced = sub_node->coalesce_latest;
+    sub_node->coalesce_latest = *msg;
+    sub_node->coalesce_pending = true;
+    os_mut_exit(&sub_node->queue->local_queue_mutex);
+
+    if (was_pending)
+    {
+        // Subscriber never saw the old value, so it's reference goes away with it
+        if (replaced.inline_len == 0)
+        {
+            release_event(replaced.data);
+        }
+        return;
+    }
+
+    // Enqueued outside the lock, consume_event needs it to resolve markers
+    event_msg_t marker;
+    marker.data.event_id = msg->data.event_id;
+    marker.data.data_ptr = sub_node;
+    marker.inline_len = 0;
+    marker.flags = EVENT_MSG_FLAG_COALESCED;
+    marker.lane = msg->lane;
+    local_eventqueue_push(sub_node->queue, &marker, true);
+}
+
+/**
+ * @brief Swaps in the newest retained event of a type
+ * @note Called with the shard lock held. The retained copy holds it's own reference on pooled payloads
+ */
+static void update_retained(event_type_queue_ll_t *node, event_msg_t *msg, bool pooled)
+{
+    if (pooled)
+    {
+        event_payload_retain(msg->data.data_ptr);
+    }
+
+    if (node->retained_valid && node->retained_msg.inline_len == 0)
+    {
+        release_event(node->retained_msg.data);
+    }
+
+    node->retained_msg = *msg;
+    node->retained_valid = true;
+}
+
+/**
+ * @brief Hands the retained event of a type to a brand new subscriber
+ * @note Called with the shard lock held, so it never blocks. If the subscriber's queue is full it just misses out
+ */
+static void deliver_retained(event_type_queue_ll_t *node, local_event_queue_ll_t *sub_node, event_msg_t *msg)
+{
+    bool pooled = msg->inline_len == 0 && event_payload_is_pooled(msg->data.data_ptr);
+    event_msg_t entry = *msg;
+#ifdef EVENT_MANAGEMENT_TRACING
+    // However old the retained event is, this delivery only starts now
+    entry.publish_us = entry.dispatch_us = EVENT_TRACE_TIME_US();
+#endif
+
+    // Same rule as the dispatcher, a coalesced type coalesces for every subscriber
+    if (sub_node->coalesce || __atomic_load_n(&node->coalesce, __ATOMIC_ACQUIRE))
+    {
+        // Fresh subscription, so nothing can be pending yet
+        sub_node->coalesce_latest = entry;
+        sub_node->coalesce_pending = true;
+        entry.data.data_ptr = sub_node;
+        entry.inline_len = 0;
+        entry.flags = EVENT_MSG_FLAG_COALESCED;
+    }
+
+    if (pooled)
+    {
+        event_payload_retain(msg->data.data_ptr);
+    }
+
+    if (local_eventqueue_push(sub_node->queue, &entry, false) != OS_RET_OK)
+    {
+        event_management_println("Subscriber queue full, skipping retained event");
+        sub_node->coalesce_pending = false;
+        if (pooled)
+        {
+            event_payload_release(msg->data.data_ptr);
+        }
+    }
+}
+
+void event_management_init(void *params)
+{
+    int num_events = EVENT_TYPE_EVENT_END;
+
+    event_queue_head = (event_type_queue_ll_t *)malloc(sizeof(event_type_queue_ll_t) * num_events);
+    if (event_queue_head == NULL)
+    {
+        event_management_println((char *)"Couldn't allocate event list");
+        return;
+    }
+
+    // Generate linked list to iterate through when publishing/subscribing events
+    for (int n = 0; n < num_events; n++)
+    {
+        event_type_queue_ll_t *node = &event_queue_head[n];
+        node->event_id = (event_type_t)n;
+        node->local_event_queue_head = NULL;
+        node->event_cb_queue_head = NULL;
+        node->coalesce = false;
+        node->retained = false;
+        node->retained_valid = false;
+        node->priority = 0;
+        node->forward = NULL;
+        node->forward_ctx = NULL;
+#ifdef EVENT_MANAGEMENT_TRACING
+        memset(&node->trace, 0, sizeof(node->trace));
+#endif
+        // Spread event types across our dispatchers
+        node->shard = n % EVENT_MANAGEMENT_NUM_DISPATCHERS;
+        node->next = (n + 1 < num_events) ? &event_queue_head[n + 1] : NULL;
+        event_management_println("Event generated initialized");
+    }
+
+    if (event_payload_pool_init() != OS_RET_OK)
+    {
+        event_management_println((char *)"Payload pool failed to initialize");
+    }
+
+    os_mut_init(&cb_executor_mut);
+    os_mut_exit(&cb_executor_mut);
+    if (safe_circular_queue_init(&cb_run_queue, EVENT_CB_MAX_ASYNC, sizeof(event_cb_ll_t *)) != OS_RET_OK)
+    {
+        event_management_println((char *)"Callback run queue failed to initialize");
+    }
+
+    for (int n = 0; n < EVENT_MANAGEMENT_NUM_DISPATCHERS; n++)
+    {
+        // Generate and clear the mutex around the shard's lists
+        os_mut_init(&event_shards[n].shard_mut);
+        os_mut_exit(&event_shards[n].shard_mut);
+        event_shards[n].sweep_pending = false;
+        event_shards[n].group.deliveries = NULL;
+        event_shards[n].group.batch = NULL;
+        event_shards[n].group.num_deliveries = 0;
+        event_shards[n].group.max_deliveries = 0;
+        if (group_grow(&event_shards[n].group, EVENT_GROUP_INIT_DELIVERIES) != OS_RET_OK)
+        {
+            event_management_println((char *)"Group deliveries failed to allocate");
+        }
+
+        for (int lane = 0; lane < EVENT_NUM_PRIORITY_LANES; lane++)
+        {
+            if (safe_circular_queue_init(&event_shards[n].publish_event_queue[lane], PUBLISH_EVENT_QUEUE_MAX_SIZE, sizeof(event_msg_t)) != OS_RET_OK)
+            {
+                event_management_println((char *)"Circular Queue Failed to initialize");
+            }
+        }
+
+        os_setbits_init(&event_shards[n].publish_signal);
+        os_clearbits(&event_shards[n].publish_signal, 1);
+    }
+
+    inited = true;
+}
+
+int event_management_set_priority(event_type_t event, int priority)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL || priority < 0 || priority >= EVENT_NUM_PRIORITY_LANES)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // Publishers read the lane without a lock, a publish racing this lands in either lane
+    __atomic_store_n(&node->priority, priority, __ATOMIC_RELEASE);
+    return OS_RET_OK;
+}
+
+int event_management_set_tap(event_tap_t tap, void *ctx)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    __atomic_store_n(&event_tap, (event_tap_t)NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&event_tap_ctx, ctx, __ATOMIC_RELEASE);
+    __atomic_store_n(&event_tap, tap, __ATOMIC_RELEASE);
+    return OS_RET_OK;
+}
+
+int event_management_set_forward(event_type_t event, event_tap_t forward, void *ctx)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    __atomic_store_n(&node->forward, (event_tap_t)NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&node->forward_ctx, ctx, __ATOMIC_RELEASE);
+    __atomic_store_n(&node->forward, forward, __ATOMIC_RELEASE);
+    return OS_RET_OK;
+}
+
+int event_management_set_static_routes(const event_static_route_t *routes, const uint16_t *route_index)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (routes == NULL || route_index == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    static_routes = routes;
+    static_route_index = route_index;
+    return OS_RET_OK;
+}
+
+int event_management_set_shard(event_type_t event, int shard)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL || shard < 0 || shard >= EVENT_MANAGEMENT_NUM_DISPATCHERS)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // The shard picks which lock guards the subscriber list of the type, moving it under a running dispatcher
+    // would let two of them walk the list under different locks
+    if (__atomic_load_n(&dispatchers_running, __ATOMIC_ACQUIRE))
+    {
+        return OS_RET_ALREADY_INITED;
+    }
+
+    node->shard = shard;
+    return OS_RET_OK;
+}
+
+static int attach_event_node(event_type_t event, event_cb_t event_cb, bool async)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (event_cb == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_management_println("Subscribing to event");
+    // Find the correct event that we need to subscribe to
+    event_type_queue_ll_t *node = event_type_node(event);
+
+    // How you got here idk, there should be a list for every event
+    if (node == NULL)
+    {
+        event_management_println("Couldn't find correct node for event");
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_management_println("Found correct node for event");
+
+    // Fully populate the node before linking it, the dispatcher walks the list without the lock
+    event_cb_ll_t *cb_node = (event_cb_ll_t *)malloc(sizeof(event_cb_ll_t));
+    if (cb_node == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+    cb_node->event_cb = event_cb;
+    cb_node->async = async;
+    cb_node->scheduled = false;
+    cb_node->removed = false;
+    cb_node->orphaned = false;
+    cb_node->dropped = 0;
+    cb_node->next = NULL;
+
+    if (async)
+    {
+        // Every async callback can sit in the run queue once, so that's our limit
+        os_mut_entry_wait_indefinite(&cb_executor_mut);
+        bool full = num_async_cbs >= EVENT_CB_MAX_ASYNC;
+        num_async_cbs += full ? 0 : 1;
+        os_mut_exit(&cb_executor_mut);
+
+        if (full || safe_circular_queue_init(&cb_node->mailbox, EVENT_CB_MAILBOX_MAX_SIZE, sizeof(event_msg_t)) != OS_RET_OK)
+        {
+            event_management_println("Couldn't setup async callback");
+            if (full == false)
+            {
+                os_mut_entry_wait_indefinite(&cb_executor_mut);
+                num_async_cbs--;
+                os_mut_exit(&cb_executor_mut);
+            }
+            free(cb_node);
+            return OS_RET_NO_MORE_RESOURCES;
+        }
+    }
+
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    // Iterate through the list to find the tail
+    event_cb_ll_t **link = &node->event_cb_queue_head;
+    while (*link != NULL)
+    {
+        event_management_println("Not first node .. iterating...");
+        // If it's already in the list we return out
+        if ((*link)->event_cb == event_cb && __atomic_load_n(&(*link)->removed, __ATOMIC_ACQUIRE) == false)
+        {
+            os_mut_exit(shard_mut);
+            if (async)
+            {
+                safe_circular_deinit(&cb_node->mailbox);
+                os_mut_entry_wait_indefinite(&cb_executor_mut);
+                num_async_cbs--;
+                os_mut_exit(&cb_executor_mut);
+            }
+            free(cb_node);
+            return OS_RET_ALREADY_INITED;
+        }
+        link = &(*link)->next;
+    }
+    *link = cb_node;
+
+    // Exit lock
+    os_mut_exit(shard_mut);
+    return OS_RET_OK;
+}
+
+int attach_event(event_type_t event, event_cb_t event_cb)
+{
+    return attach_event_node(event, event_cb, false);
+}
+
+int attach_event_async(event_type_t event, event_cb_t event_cb)
+{
+    return attach_event_node(event, event_cb, true);
+}
+
+int event_async_get_dropped(event_type_t event, event_cb_t event_cb, uint32_t *dropped)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (event_cb == NULL || dropped == NULL || node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int ret = OS_RET_INVALID_PARAM;
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    for (event_cb_ll_t *cb_node = node->event_cb_queue_head; cb_node != NULL; cb_node = cb_node->next)
+    {
+        if (cb_node->event_cb == event_cb && cb_node->async && __atomic_load_n(&cb_node->removed, __ATOMIC_ACQUIRE) == false)
+        {
+            *dropped = __atomic_load_n(&cb_node->dropped, __ATOMIC_RELAXED);
+            ret = OS_RET_OK;
+            break;
+        }
+    }
+    os_mut_exit(shard_mut);
+
+    return ret;
+}
+
+int event_management_set_retained(event_type_t event, bool retained)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    node->retained = retained;
+
+    // Let go of whatever we were holding on to
+    if (retained == false && node->retained_valid)
+    {
+        if (node->retained_msg.inline_len == 0)
+        {
+            release_event(node->retained_msg.data);
+        }
+        node->retained_valid = false;
+    }
+    os_mut_exit(shard_mut);
+
+    return OS_RET_OK;
+}
+
+static int subscribe_event_node(local_event_queue_t *local_eventqueue, event_type_t event, bool coalesce, event_filter_t filter, void *filter_ctx)
+{
+    if (local_eventqueue == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_management_println("Subscribing to event");
+    // Find the correct event that we need to subscribe to
+    event_type_queue_ll_t *node = event_type_node(event);
+
+    // How you got here idk, there should be a list for every event
+    if (node == NULL)
+    {
+        event_management_println("Couldn't find correct node for event");
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_management_println("Found correct node for event");
+
+    // Fully populate the node before linking it, the dispatcher walks the list without the lock
+    local_event_queue_ll_t *sub_node = (local_event_queue_ll_t *)malloc(sizeof(local_event_queue_ll_t));
+    if (sub_node == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+    sub_node->queue = local_eventqueue;
+    sub_node->coalesce = coalesce;
+    sub_node->coalesce_pending = false;
+    sub_node->filter = filter;
+    sub_node->filter_ctx = filter_ctx;
+    sub_node->removed = false;
+    sub_node->orphaned = false;
+    sub_node->orphan_next = NULL;
+    sub_node->next = NULL;
+
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    // Iterate through the list to find the tail
+    local_event_queue_ll_t **link = &node->local_event_queue_head;
+    while (*link != NULL)
+    {
+        event_management_println("Not first node .. iterating...");
+        // If it's already in the list we return out
+        if ((*link)->queue == local_eventqueue && __atomic_load_n(&(*link)->removed, __ATOMIC_ACQUIRE) == false)
+        {
+            os_mut_exit(shard_mut);
+            free(sub_node);
+            return OS_RET_ALREADY_INITED;
+        }
+        link = &(*link)->next;
+    }
+    *link = sub_node;
+    // Subscription keeps the queue alive until the dispatcher reclaims it
+    __atomic_add_fetch(&local_eventqueue->refs, 1, __ATOMIC_RELAXED);
+
+    // Late subscribers immediately get the last published value
+    if (node->retained && node->retained_valid && subscriber_filtered(sub_node, &node->retained_msg) == false)
+    {
+        deliver_retained(node, sub_node, &node->retained_msg);
+    }
+
+    // Exit lock
+    os_mut_exit(shard_mut);
+    return OS_RET_OK;
+}
+
+int subscribe_event(local_event_queue_t *local_eventqueue, event_type_t event)
+{
+    return subscribe_event_node(local_eventqueue, event, false, NULL, NULL);
+}
+
+int subscribe_event_coalesced(local_event_queue_t *local_eventqueue, event_type_t event)
+{
+    return subscribe_event_node(local_eventqueue, event, true, NULL, NULL);
+}
+
+int subscribe_event_filtered(local_event_queue_t *local_eventqueue, event_type_t event, event_filter_t filter, void *filter_ctx)
+{
+    if (filter == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    return subscribe_event_node(local_eventqueue, event, false, filter, filter_ctx);
+}
+
+int event_management_set_coalesce(event_type_t event, bool coalesce)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    __atomic_store_n(&node->coalesce, coalesce, __ATOMIC_RELEASE);
+    return OS_RET_OK;
+}
+
+int unsubscribe_event(local_event_queue_t *local_eventqueue, event_type_t event)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (local_eventqueue == NULL || node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int ret = OS_RET_INVALID_PARAM;
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    for (local_event_queue_ll_t *sub_node = node->local_event_queue_head; sub_node != NULL; sub_node = sub_node->next)
+    {
+        // Only marked here, the dispatcher might be walking past it right now
+        if (sub_node->queue == local_eventqueue && __atomic_load_n(&sub_node->removed, __ATOMIC_ACQUIRE) == false)
+        {
+            __atomic_store_n(&sub_node->removed, true, __ATOMIC_RELEASE);
+            request_sweep(node->shard);
+            ret = OS_RET_OK;
+            break;
+        }
+    }
+    os_mut_exit(shard_mut);
+
+    return ret;
+}
+
+int detach_event(event_type_t event, event_cb_t event_cb)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (event_cb == NULL || node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int ret = OS_RET_INVALID_PARAM;
+    os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+    os_mut_entry_wait_indefinite(shard_mut);
+    for (event_cb_ll_t *cb_node = node->event_cb_queue_head; cb_node != NULL; cb_node = cb_node->next)
+    {
+        // Only marked here, the dispatcher might be walking past it right now
+        if (cb_node->event_cb == event_cb && __atomic_load_n(&cb_node->removed, __ATOMIC_ACQUIRE) == false)
+        {
+            __atomic_store_n(&cb_node->removed, true, __ATOMIC_RELEASE);
+            request_sweep(node->shard);
+            ret = OS_RET_OK;
+            break;
+        }
+    }
+    os_mut_exit(shard_mut);
+
+    return ret;
+}
+
+int delete_local_eventqueue(local_event_queue_t *local_eventqueue)
+{
+    if (local_eventqueue == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    // No new subscriptions or consumers from here on
+    local_eventqueue->eventqueue_status = OS_STATUS_UNINITIALIZED;
+
+    for (int n = 0; n < EVENT_TYPE_EVENT_END; n++)
+    {
+        event_type_queue_ll_t *node = &event_queue_head[n];
+        os_mut_t *shard_mut = &event_shards[node->shard].shard_mut;
+        os_mut_entry_wait_indefinite(shard_mut);
+        for (local_event_queue_ll_t *sub_node = node->local_event_queue_head; sub_node != NULL; sub_node = sub_node->next)
+        {
+            if (sub_node->queue == local_eventqueue && __atomic_load_n(&sub_node->removed, __ATOMIC_ACQUIRE) == false)
+            {
+                __atomic_store_n(&sub_node->removed, true, __ATOMIC_RELEASE);
+                request_sweep(node->shard);
+            }
+        }
+        os_mut_exit(shard_mut);
+    }
+
+    // A dispatcher could be blocked on our full queue, make room so it can move on and see we're gone
+    drain_local_eventqueue(local_eventqueue);
+
+    // Actually freed once every dispatcher has reclaimed our subscriptions
+    local_eventqueue_release(local_eventqueue);
+    return OS_RET_OK;
+}
+
+/**
+ * @brief Brings up a local eventqueue, on malloc'd memory unless we were handed storage and a landing area
+ */
+static void local_eventqueue_setup(local_event_queue_t *queue, int num_elements_queue, event_msg_t *storage, event_msg_t *landing)
+{
+    queue->eventqueue_status = OS_STATUS_INITIALIZED;
+    queue->refs = 1;
+    queue->landing = NULL;
+    queue->static_storage = storage != NULL;
+#ifdef EVENT_MANAGEMENT_TRACING
+    memset(&queue->consume_latency, 0, sizeof(queue->consume_latency));
+    queue->depth_max = 0;
+#endif
+
+    int ret = os_mut_init(&queue->local_queue_mutex);
+    if (ret != OS_RET_OK)
+    {
+        event_management_println("Wasn't able to initialize another eventqueue mutex");
+        queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
+        return;
+    }
+
+    os_mut_exit(&queue->local_queue_mutex);
+    for (int lane = 0; lane < EVENT_NUM_PRIORITY_LANES; lane++)
+    {
+        if (storage != NULL)
+        {
+            ret = safe_circular_queue_init_static(&queue->event_queue[lane], &storage[lane * num_elements_queue], num_elements_queue, sizeof(event_msg_t));
+        }
+        else
+        {
+            ret = safe_circular_queue_init(&queue->event_queue[lane], num_elements_queue, sizeof(event_msg_t));
+        }
+
+        if (ret != OS_RET_OK)
+        {
+            event_management_println("Wasn't able to initialize another eventqueue circular queue");
+            queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
+            return;
+        }
+    }
+
+    ret = os_setbits_init(&queue->event_signal);
+    if (ret != OS_RET_OK)
+    {
+        event_management_println("Wasn't able to initialize another eventqueue signal");
+        queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
+        return;
+    }
+    os_clearbits(&queue->event_signal, 1);
+
+    // Batches land here straight out of the queue, so it's as big as the queue itself
+    queue->landing_len = num_elements_queue;
+    queue->landing = landing != NULL ? landing : (event_msg_t *)malloc(sizeof(event_msg_t) * num_elements_queue);
+    if (queue->landing == NULL)
+    {
+        event_management_println("Wasn't able to allocate eventqueue landing area");
+        queue->eventqueue_status = OS_STATUS_MODULE_FAILED;
+    }
+}
+
+local_event_queue_t *new_local_eventqueue(int num_elements_queue)
+{
+    local_event_queue_t *queue = (local_event_queue_t *)malloc(sizeof(local_event_queue_t));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+
+    if (num_elements_queue == 0)
+    {
+        num_elements_queue = PER_QUEUE_MAX_SIZE;
+    }
+
+    local_eventqueue_setup(queue, num_elements_queue, NULL, NULL);
+    return queue;
+}
+
+int local_eventqueue_init_static(local_event_queue_t *queue, event_msg_t *storage, event_msg_t *landing, int num_elements_queue)
+{
+    if (queue == NULL || storage == NULL || landing == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (num_elements_queue <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    local_eventqueue_setup(queue, num_elements_queue, storage, landing);
+    return queue->eventqueue_status == OS_STATUS_INITIALIZED ? OS_RET_OK : OS_RET_INT_ERR;
+}
+
+static int publish_event_msg(event_msg_t *msg)
+{
+    event_type_queue_ll_t *node = event_type_node(msg->data.event_id);
+    if (node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // Enqueue to the publish queue of the dispatcher that owns this event type, in the type's lane
+    msg->lane = __atomic_load_n(&node->priority, __ATOMIC_ACQUIRE);
+    msg->publish_us = EVENT_TRACE_TIME_US();
+#ifdef EVENT_MANAGEMENT_TRACING
+    msg->dispatch_us = msg->publish_us;
+#endif
+    return shard_push(&event_shards[node->shard], msg, true);
+}
+
+int publish_event(int event, void *ptr)
+{
+    if (event_type_node(event) == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_msg_t msg;
+    msg.data.event_id = (event_type_t)event;
+    msg.data.data_ptr = ptr;
+    msg.inline_len = 0;
+    msg.flags = 0;
+    msg.group_len = 0;
+
+    return publish_event_msg(&msg);
+}
+
+static int publish_event_inline_flags(int event, const void *data, size_t len, uint8_t flags)
+{
+    if (event_type_node(event) == NULL || len > EVENT_INLINE_DATA_MAX || (data == NULL && len > 0))
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_msg_t msg;
+    msg.data.event_id = (event_type_t)event;
+    msg.data.data_ptr = NULL;
+    msg.inline_len = len;
+    msg.flags = flags;
+    msg.group_len = 0;
+    memcpy(msg.inline_data.bytes, data, len);
+
+    return publish_event_msg(&msg);
+}
+
+int publish_event_inline(int event, const void *data, size_t len)
+{
+    return publish_event_inline_flags(event, data, len, 0);
+}
+
+int publish_event_remote(int event, const void *data, size_t len)
+{
+    return publish_event_inline_flags(event, data, len, EVENT_MSG_FLAG_REMOTE);
+}
+
+int publish_events(const event_data_t *events, int num_events)
+{
+    if (events == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (num_events <= 0 || num_events > EVENT_PUBLISH_GROUP_MAX)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // The whole group rides in one lane of one shard. Moving an event into another lane than the rest of
+    // it's type would let it overtake, or fall behind, events of that type published one by one
+    int shard = -1;
+    int lane = -1;
+    for (int n = 0; n < num_events; n++)
+    {
+        event_type_queue_ll_t *node = event_type_node(events[n].event_id);
+        int node_lane = node == NULL ? -1 : __atomic_load_n(&node->priority, __ATOMIC_ACQUIRE);
+        if (node == NULL || (shard >= 0 && (node->shard != shard || node_lane != lane)))
+        {
+            return OS_RET_INVALID_PARAM;
+        }
+
+        shard = node->shard;
+        lane = node_lane;
+    }
+
+    event_msg_t msgs[EVENT_PUBLISH_GROUP_MAX];
+    for (int n = 0; n < num_events; n++)
+    {
+        msgs[n].data = events[n];
+        msgs[n].inline_len = 0;
+        msgs[n].flags = 0;
+        msgs[n].lane = lane;
+        // Only the first one says how many follow, that's where the dispatcher picks the group up
+        msgs[n].group_len = n == 0 ? num_events : 0;
+        msgs[n].publish_us = EVENT_TRACE_TIME_US();
+#ifdef EVENT_MANAGEMENT_TRACING
+        msgs[n].dispatch_us = msgs[n].publish_us;
+#endif
+    }
+
+    return shard_push_group(&event_shards[shard], msgs, num_events);
+}
+
+/**
+ * @brief Hands an event to an async callback and makes sure a worker is going to run it
+ */
+static void schedule_async_cb(event_cb_ll_t *cb_node, event_msg_t *msg)
+{
+    // Mailbox first, a worker that is just finishing up checks it under the executor lock
+    if (safe_circular_enqueue(&cb_node->mailbox, sizeof(event_msg_t), msg) != OS_RET_OK)
+    {
+        // Callback is falling behind, drop it rather than hold up the dispatcher.
+        // A full mailbox is always already scheduled, so there's nothing else to do
+        __atomic_fetch_add(&cb_node->dropped, 1, __ATOMIC_RELAXED);
+        event_management_println("Async callback mailbox full, dropping event");
+        if (msg->inline_len == 0)
+        {
+            release_event(msg->data);
+        }
+        return;
+    }
+
+    os_mut_entry_wait_indefinite(&cb_executor_mut);
+    bool schedule = __atomic_load_n(&cb_node->scheduled, __ATOMIC_ACQUIRE) == false;
+    __atomic_store_n(&cb_node->scheduled, true, __ATOMIC_RELEASE);
+    os_mut_exit(&cb_executor_mut);
+
+    // Already queued or running, whoever has it will drain the mailbox
+    if (schedule)
+    {
+        safe_circular_enqueue_notimeout(&cb_run_queue, sizeof(event_cb_ll_t *), &cb_node);
+    }
+}
+
+void event_cb_executor_thread(void *parameters)
+{
+    for (;;)
+    {
+        event_cb_ll_t *cb_node;
+        safe_circular_dequeue_notimeout(&cb_run_queue, sizeof(cb_node), &cb_node);
+
+        // Only ever one worker owns a callback at a time, so it never runs concurrently with itself
+        int n;
+        for (n = 0; n < EVENT_CB_EXECUTOR_BATCH; n++)
+        {
+            event_msg_t msg;
+            if (safe_circular_dequeue(&cb_node->mailbox, sizeof(msg), &msg) != OS_RET_OK)
+            {
+                break;
+            }
+
+            // Detached callbacks just get their mailbox emptied
+            if (__atomic_load_n(&cb_node->removed, __ATOMIC_ACQUIRE) == false)
+            {
+#ifdef EVENT_MANAGEMENT_TRACING
+                trace_consumed(NULL, &msg, 1);
+#endif
+                cb_node->event_cb(event_msg_view(&msg));
+            }
+            if (msg.inline_len == 0)
+            {
+                release_event(msg.data);
+            }
+        }
+
+        os_mut_entry_wait_indefinite(&cb_executor_mut);
+        bool orphaned = cb_node->orphaned;
+        bool more = safe_circular_queue_count(&cb_node->mailbox) > 0 && orphaned == false;
+        __atomic_store_n(&cb_node->scheduled, more, __ATOMIC_RELEASE);
+        if (orphaned)
+        {
+            num_async_cbs--;
+        }
+        os_mut_exit(&cb_executor_mut);
+
+        // Dispatcher reclaimed it while we had it, so it's on us to free it
+        if (orphaned)
+        {
+            destroy_async_cb(cb_node);
+            continue;
+        }
+
+        // Still busy, go to the back of the line so other callbacks get a turn
+        if (more)
+        {
+            safe_circular_enqueue_notimeout(&cb_run_queue, sizeof(event_cb_ll_t *), &cb_node);
+        }
+    }
+}
+
+/**
+ * @brief Runs one event through the taps, static routes, subscribers and callbacks of it's type
+ * @note Deliveries into local eventqueues go through the shard's group, which hands them
+ * out once every event of a publish_events group went through here
+ */
+static void dispatch_msg(event_dispatcher_shard_t *shard, event_msg_t *msg)
+{
+    // Find the correct event that we just got published
+    event_type_queue_ll_t *node = event_type_node(msg->data.event_id);
+
+    // If we somehow couldn't find anyone subcribed to those events
+    if (node == NULL)
+    {
+        return;
+    }
+
+#ifdef EVENT_MANAGEMENT_TRACING
+    msg->dispatch_us = EVENT_TRACE_TIME_US();
+    event_trace_hist_record(&node->trace.stages[EVENT_TRACE_PUBLISH_TO_DISPATCH], msg->dispatch_us - msg->publish_us);
+    // Counting the one we are holding
+    trace_gauge(&node->trace.publish_depth_max, safe_circular_queue_count(&shard->publish_event_queue[msg->lane]) + 1);
+#endif
+
+    event_tap_t tap = __atomic_load_n(&event_tap, __ATOMIC_ACQUIRE);
+    if (tap != NULL)
+    {
+        tap(msg, __atomic_load_n(&event_tap_ctx, __ATOMIC_ACQUIRE));
+    }
+
+    event_tap_t forward = __atomic_load_n(&node->forward, __ATOMIC_ACQUIRE);
+    if (forward != NULL && (msg->flags & EVENT_MSG_FLAG_REMOTE) == 0)
+    {
+        forward(msg, __atomic_load_n(&node->forward_ctx, __ATOMIC_ACQUIRE));
+    }
+
+    // The bus holds the publisher's reference on pooled payloads while we fan out
+    bool pooled = msg->inline_len == 0 && event_payload_is_pooled(msg->data.data_ptr);
+
+    // Compile time routes first, the table never changes so there's nothing to lock
+    if (static_routes != NULL)
+    {
+        for (int n = static_route_index[msg->data.event_id]; n < static_route_index[msg->data.event_id + 1]; n++)
+        {
+            const event_static_route_t *route = &static_routes[n];
+            if (route->queue != NULL)
+            {
+                if (pooled)
+                {
+                    event_payload_retain(msg->data.data_ptr);
+                }
+                group_deliver(&shard->group, route->queue, msg);
+            }
+            if (route->event_cb != NULL)
+            {
+                route->event_cb(event_msg_view(msg));
+            }
+        }
+    }
+
+    // Iterated through all subscribed lists of that head
+    // And add the event to their own localized eventqueue
+    os_mut_entry_wait_indefinite(&shard->shard_mut);
+    local_event_queue_ll_t *head = node->local_event_queue_head;
+    local_event_queue_ll_t *last = NULL;
+    event_cb_ll_t *cb_head = node->event_cb_queue_head;
+    if (node->retained)
+    {
+        update_retained(node, msg, pooled);
+
+        // Anyone subscribing from here on gets this event as the retained one,
+        // so we stop at whoever is subscribed right now
+        last = head;
+        while (last != NULL && last->next != NULL)
+        {
+            last = last->next;
+        }
+    }
+    os_mut_exit(&shard->shard_mut);
+
+    while (head != NULL)
+    {
+        // Filtered out events never take up a slot in the subscriber's queue
+        if (__atomic_load_n(&head->removed, __ATOMIC_ACQUIRE) || subscriber_filtered(head, msg))
+        {
+            goto next_subscriber;
+        }
+
+        // Every subscriber queue gets it's own reference, dropped in release_event
+        if (pooled)
+        {
+            event_payload_retain(msg->data.data_ptr);
+        }
+
+        if (head->coalesce || __atomic_load_n(&node->coalesce, __ATOMIC_ACQUIRE))
+        {
+            deliver_coalesced(head, msg);
+        }
+        else
+        {
+            group_deliver(&shard->group, head->queue, msg);
+            event_management_println("Submitting event to local queue");
+        }
+
+    next_subscriber:
+        if (head == last)
+        {
+            break;
+        }
+        head = head->next;
+    }
+
+    // Callbacks read inline payloads straight out of our copy
+    event_data_t data = event_msg_view(msg);
+
+    while (cb_head != NULL)
+    {
+        if (__atomic_load_n(&cb_head->removed, __ATOMIC_ACQUIRE))
+        {
+            // Waiting to be reclaimed
+        }
+        else if (cb_head->async)
+        {
+            if (pooled)
+            {
+                event_payload_retain(msg->data.data_ptr);
+            }
+            schedule_async_cb(cb_head, msg);
+        }
+        else
+        {
+            cb_head->event_cb(data);
+        }
+        cb_head = cb_head->next;
+    }
+
+    // Callbacks are done with it, so the bus lets go of it's reference
+    if (pooled)
+    {
+        event_payload_release(data.data_ptr);
+    }
+}
+
+void event_management_thread(void *parameters)
+{
+    int shard_index = (int)(intptr_t)parameters;
+    if (shard_index < 0 || shard_index >= EVENT_MANAGEMENT_NUM_DISPATCHERS)
+    {
+        event_management_println("Invalid dispatcher shard");
+        return;
+    }
+
+    __atomic_store_n(&dispatchers_running, true, __ATOMIC_RELEASE);
+    event_dispatcher_shard_t *shard = &event_shards[shard_index];
+    event_group_t *group = &shard->group;
+    for (;;)
+    {
+        // Sit and wait until we get data, urgent lanes first
+        if (lanes_pop(shard->publish_event_queue, &shard->publish_signal, &group->msgs[0], 1, EVENT_WAIT_FOREVER) != 1)
+        {
+            continue;
+        }
+        event_management_println("Got an event from queue");
+
+        if (group->msgs[0].flags & EVENT_MSG_FLAG_SWEEP)
+        {
+            sweep_shard(shard_index);
+            continue;
+        }
+
+        // The rest of a publish_events group got enqueued right behind it's first event, in the same lane
+        group->num_msgs = 1;
+        if (group->msgs[0].group_len > 1)
+        {
+            int ret = safe_circular_dequeue_batch_timeout(&shard->publish_event_queue[group->msgs[0].lane], sizeof(event_msg_t),
+                                                          &group->msgs[1], group->msgs[0].group_len - 1, 0);
+            if (ret > 0)
+            {
+                group->num_msgs += ret;
+            }
+        }
+
+        for (int n = 0; n < group->num_msgs; n++)
+        {
+            dispatch_msg(shard, &group->msgs[n]);
+        }
+        group_flush(group);
+
+        // Between events nothing is walking our lists, so this is where removed nodes get freed.
+        // Peeking without the lock is fine, request_sweep also queues us a wakeup
+        if (shard->sweep_pending)
+        {
+            sweep_shard(shard_index);
+        }
+    }
+}
+
+int subscribe_eventlist(local_event_queue_t *local_eventqueue, int *event_list, int num_events, int event_length_max)
+{
+    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    for (int n = 0; n < num_events; n++)
+    {
+        event_management_println("subcribed event in list");
+        int ret = subscribe_event(local_eventqueue, (event_type_t)event_list[n]);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+    }
+    return OS_RET_OK;
+}
+
+bool available_events(local_event_queue_t *local_eventqueue)
+{
+    if (local_eventqueue == NULL)
+    {
+        return false;
+    }
+
+    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    {
+        return false;
+    }
+
+    for (int lane = 0; lane < EVENT_NUM_PRIORITY_LANES; lane++)
+    {
+        if (safe_circular_queue_count(&local_eventqueue->event_queue[lane]) > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int consume_events(local_event_queue_t *local_eventqueue, event_data_t *events, int max_events, uint32_t timeout_ms)
+{
+    if (local_eventqueue == NULL || events == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (local_eventqueue->eventqueue_status != OS_STATUS_INITIALIZED)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (max_events <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // Can't hand out more than fits in the landing area
+    if (max_events > local_eventqueue->landing_len)
+    {
+        max_events = local_eventqueue->landing_len;
+    }
+
+    event_msg_t *msgs = local_eventqueue->landing;
+    // Higher lanes always get drained first
+    int num = lanes_pop(local_eventqueue->event_queue, &local_eventqueue->event_signal, msgs, max_events, timeout_ms);
+    if (num <= 0)
+    {
+        return num;
+    }
+
+    // Swap the markers for whatever the newest value is by now
+    resolve_coalesced(local_eventqueue, msgs, num);
+#ifdef EVENT_MANAGEMENT_TRACING
+    trace_consumed(local_eventqueue, msgs, num);
+#endif
+
+    // Inline payloads already got copied out of the queue slots, so they can be read right out of the landing area
+    for (int n = 0; n < num; n++)
+    {
+        events[n] = event_msg_view(&msgs[n]);
+    }
+
+    return num;
+}
+
+event_data_t consume_event(local_event_queue_t *local_eventqueue)
+{
+    event_data_t data;
+    data.data_ptr = NULL;
+    data.event_id = EVENT_NONE;
+
+    if (consume_events(local_eventqueue, &data, 1, EVENT_WAIT_FOREVER) != 1)
+    {
+        data.data_ptr = NULL;
+        data.event_id = EVENT_NONE;
+    }
+    return data;
+}
+
+int release_event(event_data_t event)
+{
+    if (event_payload_is_pooled(event.data_ptr) == false)
+    {
+        return OS_RET_OK;
+    }
+
+    return event_payload_release(event.data_ptr);
+}
+
+#ifdef EVENT_MANAGEMENT_TRACING
+int event_trace_get(event_type_t event, event_trace_stage_t stage, event_trace_stats_t *stats)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (stats == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL || stage < 0 || stage >= EVENT_TRACE_NUM_STAGES)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_trace_hist_stats(&node->trace.stages[stage], stats);
+    return OS_RET_OK;
+}
+
+int event_trace_get_depth(event_type_t event, uint32_t *publish_depth_max, uint32_t *subscriber_depth_max)
+{
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_type_queue_ll_t *node = event_type_node(event);
+    if (node == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    if (publish_depth_max != NULL)
+    {
+        *publish_depth_max = __atomic_load_n(&node->trace.publish_depth_max, __ATOMIC_RELAXED);
+    }
+    if (subscriber_depth_max != NULL)
+    {
+        *subscriber_depth_max = __atomic_load_n(&node->trace.subscriber_depth_max, __ATOMIC_RELAXED);
+    }
+    return OS_RET_OK;
+}
+
+int event_trace_queue_get(local_event_queue_t *local_eventqueue, event_trace_stats_t *stats, uint32_t *depth_max)
+{
+    if (local_eventqueue == NULL || stats == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    event_trace_hist_stats(&local_eventqueue->consume_latency, stats);
+    if (depth_max != NULL)
+    {
+        *depth_max = __atomic_load_n(&local_eventqueue->depth_max, __ATOMIC_RELAXED);
+    }
+    return OS_RET_OK;
+}
+
+void event_trace_reset(void)
+{
+    if (inited == false)
+    {
+        return;
+    }
+
+    for (int n = 0; n < EVENT_TYPE_EVENT_END; n++)
+    {
+        event_type_queue_ll_t *node = &event_queue_head[n];
+        for (int stage = 0; stage < EVENT_TRACE_NUM_STAGES; stage++)
+        {
+            trace_clear(&node->trace.stages[stage]);
+        }
+        __atomic_store_n(&node->trace.publish_depth_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&node->trace.subscriber_depth_max, 0, __ATOMIC_RELAXED);
+    }
+}
+
+int event_trace_dump(FILE *fp)
+{
+    static const char *stage_names[EVENT_TRACE_NUM_STAGES] = {"publish->dispatch", "dispatch->consume", "publish->consume"};
+
+    if (inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (fp == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    fprintf(fp, "event stage count p50_us p99_us max_us\n");
+    for (int n = 0; n < EVENT_TYPE_EVENT_END; n++)
+    {
+        event_type_queue_ll_t *node = &event_queue_head[n];
+        bool any = false;
+        for (int stage = 0; stage < EVENT_TRACE_NUM_STAGES; stage++)
+        {
+            event_trace_stats_t stats;
+            event_trace_hist_stats(&node->trace.stages[stage], &stats);
+            if (stats.count == 0)
+            {
+                continue;
+            }
+
+            any = true;
+            fprintf(fp, "%d %s %lu %lu %lu %lu\n", n, stage_names[stage], (unsigned long)stats.count,
+                    (unsigned long)stats.p50_us, (unsigned long)stats.p99_us, (unsigned long)stats.max_us);
+        }
+
+        // Types nobody published don't clutter up the dump
+        if (any)
+        {
+            fprintf(fp, "%d depth publish_max=%lu subscriber_max=%lu\n", n,
+                    (unsigned long)__atomic_load_n(&node->trace.publish_depth_max, __ATOMIC_RELAXED),
+                    (unsigned long)__atomic_load_n(&node->trace.subscriber_depth_max, __ATOMIC_RELAXED));
+        }
+    }
+
+    fflush(fp);
+    return OS_RET_OK;
+}
+#endif
+
+#ifdef UNIT_CHECK_MODULE
+// Gives the dispatchers time to work through what got published
+#define EVENT_MANAGEMENT_UNIT_SETTLE_MS 20
+
+// Reads the int an event carries inline, -1 if nothing came
+static int event_management_unit_value(local_event_queue_t *queue)
+{
+    event_data_t event;
+    if (consume_events(queue, &event, 1, EVENT_MANAGEMENT_UNIT_SETTLE_MS) != 1 || event.data_ptr == NULL)
+    {
+        return -1;
+    }
+    return *(int *)event.data_ptr;
+}
+
+int event_management_unit_test(void)
+{
+    unit_test_mod_init();
+
+    // Runs on the application's first event type, whatever it's called
+    event_type_t event = (event_type_t)0;
+    if (event_queue_head == NULL)
+    {
+        event_management_init(NULL);
+    }
+    assert_testcase_not_null("Event management init", event_queue_head);
+    if (__atomic_load_n(&dispatchers_running, __ATOMIC_ACQUIRE) == false)
+    {
+        for (intptr_t shard = 0; shard < EVENT_MANAGEMENT_NUM_DISPATCHERS; shard++)
+        {
+            os_add_thread((thread_func_t)event_management_thread, (void *)shard, 0, NULL);
+        }
+    }
+
+    // A coalesced subscriber that falls behind only sees the newest value, a plain one sees them all
+    local_event_queue_t *plain = new_local_eventqueue(8);
+    local_event_queue_t *coalesced = new_local_eventqueue(8);
+    assert_testcase_equal("subscribe plain", subscribe_event(plain, event), OS_RET_OK);
+    assert_testcase_equal("subscribe coalesced", subscribe_event_coalesced(coalesced, event), OS_RET_OK);
+    for (int n = 1; n <= 3; n++)
+    {
+        publish_event_inline(event, &n, sizeof(n));
+    }
+    for (int n = 1; n <= 3; n++)
+    {
+        assert_testcase_equal("plain subscriber gets every event", event_management_unit_value(plain), n);
+    }
+    os_thread_sleep_ms(EVENT_MANAGEMENT_UNIT_SETTLE_MS);
+    assert_testcase_equal("coalesced subscriber gets the newest", event_management_unit_value(coalesced), 3);
+    assert_testcase_equal("coalesced subscriber gets it once", available_events(coalesced), false);
+    delete_local_eventqueue(coalesced);
+
+    // A new subscriber of a retained type starts out with the last event published
+    assert_testcase_equal("set retained", event_management_set_retained(event, true), OS_RET_OK);
+    int value = 4;
+    publish_event_inline(event, &value, sizeof(value));
+    assert_testcase_equal("plain subscriber gets the retained type's event", event_management_unit_value(plain), 4);
+    local_event_queue_t *late = new_local_eventqueue(8);
+    subscribe_event(late, event);
+    assert_testcase_equal("late subscriber gets the retained event", event_management_unit_value(late), 4);
+    delete_local_eventqueue(late);
+
+    // With the whole type coalesced, the retained event and the next publish collapse into one
+    assert_testcase_equal("set coalesce", event_management_set_coalesce(event, true), OS_RET_OK);
+    late = new_local_eventqueue(8);
+    subscribe_event(late, event);
+    value = 5;
+    publish_event_inline(event, &value, sizeof(value));
+    event_management_unit_value(plain);
+    os_thread_sleep_ms(EVENT_MANAGEMENT_UNIT_SETTLE_MS);
+    assert_testcase_equal("retained event coalesced with the next one", event_management_unit_value(late), 5);
+    assert_testcase_equal("nothing left behind the retained event", available_events(late), false);
+    delete_local_eventqueue(late);
+
+    event_management_set_coalesce(event, false);
+    event_management_set_retained(event, false);
+    delete_local_eventqueue(plain);
+
+    unit_testcase_end();
+    return OS_RET_OK;
+}
+#endif
 #endif
\ No newline at end of file
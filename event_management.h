@@ -3,30 +3,262 @@
 
 #include "os_error.h"
 #include "safe_circular_queue.h"
+#include "event_payload_pool.h"
 #include "os_status.h"
 #include "event_type_list.h"
 #include "enabled_modules.h"
 #ifndef OS_EVENTQUEUE
 
+/**
+ * @brief Number of dispatcher threads(shards) the event bus is split into
+ * @note Every event type is owned by exactly one shard, so ordering per event type is preserved
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef EVENT_MANAGEMENT_NUM_DISPATCHERS
+#define EVENT_MANAGEMENT_NUM_DISPATCHERS 1
+#endif
+
+/**
+ * @brief Number of priority lanes on the bus, each lane gets it's own publish and subscriber queues
+ * @note Lane 0 is the default, higher lanes are more urgent and always get drained first
+ * @note Can be overridden in enabled_modules.h, 1 turns priorities off
+ */
+#ifndef EVENT_NUM_PRIORITY_LANES
+#define EVENT_NUM_PRIORITY_LANES 2
+#endif
+
+#define EVENT_PRIORITY_NORMAL 0
+#define EVENT_PRIORITY_URGENT (EVENT_NUM_PRIORITY_LANES - 1)
+
+/**
+ * @brief Async callback executor sizing
+ * @note EVENT_CB_MAX_ASYNC is how many callbacks can be attached with attach_event_async,
+ * EVENT_CB_MAILBOX_MAX_SIZE how many events each one can have waiting before new ones get dropped and
+ * EVENT_CB_EXECUTOR_BATCH how many events a worker runs for one callback before moving on to the next
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef EVENT_CB_MAX_ASYNC
+#define EVENT_CB_MAX_ASYNC 32
+#endif
+#ifndef EVENT_CB_MAILBOX_MAX_SIZE
+#define EVENT_CB_MAILBOX_MAX_SIZE 16
+#endif
+#ifndef EVENT_CB_EXECUTOR_BATCH
+#define EVENT_CB_EXECUTOR_BATCH 8
+#endif
+
+/**
+ * @brief Most events publish_events can publish as one group
+ * @note Can be overridden in enabled_modules.h, has to fit in the publish queue
+ */
+#ifndef EVENT_PUBLISH_GROUP_MAX
+#define EVENT_PUBLISH_GROUP_MAX 8
+#endif
+
+/**
+ * @brief Largest payload in bytes that can be published by value with publish_event_inline
+ * @note Can be overridden in enabled_modules.h, the length travels in a uint8_t
+ */
+#ifndef EVENT_INLINE_DATA_MAX
+#define EVENT_INLINE_DATA_MAX 16
+#endif
+static_assert(EVENT_INLINE_DATA_MAX <= UINT8_MAX, "EVENT_INLINE_DATA_MAX has to fit in event_msg_t::inline_len");
+
+// Bucket n holds latencies in [2^(n-1), 2^n) us, bucket 0 is anything under 1us
+#define EVENT_TRACE_NUM_BUCKETS 32
+
+/**
+ * @brief Log2 latency histogram, only ever touched with atomics so recording never takes a lock
+ */
+typedef struct event_trace_hist_t
+{
+    uint32_t buckets[EVENT_TRACE_NUM_BUCKETS];
+    uint32_t max_us;
+} event_trace_hist_t;
+
+/**
+ * @brief Summary of a histogram
+ * @note Percentiles are the upper bound of the bucket they fall in, so they're accurate to within 2x
+ */
+typedef struct event_trace_stats_t
+{
+    uint32_t count;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} event_trace_stats_t;
+
+/**
+ * @brief Microsecond clock every event gets stamped with when it's published
+ * @note CLOCK_MONOTONIC on Linux, elsewhere it defaults to the millisecond tick. Override in enabled_modules.h
+ * with a hardware cycle counter or a free running timer to get real microsecond resolution.
+ * Only differences are used, so wrapping is fine
+ */
+#ifndef EVENT_TRACE_TIME_US
+#ifdef __linux__
+#include <time.h>
+static inline uint32_t event_trace_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+#define EVENT_TRACE_TIME_US() event_trace_time_us()
+#else
+#define EVENT_TRACE_TIME_US() ((uint32_t)(get_current_time_millis() * 1000))
+#endif
+#endif
+
+#ifdef EVENT_MANAGEMENT_TRACING
+#include <stdio.h>
+
+/**
+ * @brief Legs of the event path we keep histograms for
+ */
+typedef enum event_trace_stage_t
+{
+    // Sitting in the shard's publish queue
+    EVENT_TRACE_PUBLISH_TO_DISPATCH = 0,
+    // Sitting in a subscriber queue or async callback mailbox
+    EVENT_TRACE_DISPATCH_TO_CONSUME,
+    // End to end
+    EVENT_TRACE_PUBLISH_TO_CONSUME,
+    EVENT_TRACE_NUM_STAGES
+} event_trace_stage_t;
+
+/**
+ * @brief Per event type tracing data
+ */
+typedef struct event_trace_type_t
+{
+    event_trace_hist_t stages[EVENT_TRACE_NUM_STAGES];
+    // Deepest the publish lane got when one of these was dispatched
+    uint32_t publish_depth_max;
+    // Deepest any subscriber lane got when one of these was put in it
+    uint32_t subscriber_depth_max;
+} event_trace_type_t;
+#endif
+
+/**
+ * @brief Small payload storage carried by value through the queues
+ */
+typedef union event_inline_data_t
+{
+    uint8_t bytes[EVENT_INLINE_DATA_MAX];
+    uint64_t align;
+} event_inline_data_t;
+
+/**
+ * @brief What actually travels through the publish and subscriber queues
+ * @note event_data_t is defined by the application in event_type_list.h, so inline payloads ride next to it
+ * and data_ptr gets pointed at them when the event is handed out
+ */
+typedef struct event_msg_t
+{
+    event_data_t data;
+    // Zero when data_ptr is a regular pointer
+    uint8_t inline_len;
+    uint8_t flags;
+    // Priority lane the event travels in
+    uint8_t lane;
+    // Set on the first event of a publish_events group, how many events the group has
+    uint8_t group_len;
+    // EVENT_TRACE_TIME_US when it got published, taps see when the event happened rather than when it got dispatched
+    uint32_t publish_us;
+#ifdef EVENT_MANAGEMENT_TRACING
+    uint32_t dispatch_us;
+#endif
+    event_inline_data_t inline_data;
+} event_msg_t;
+
 typedef struct
 {
     os_mut_t local_queue_mutex;
-    safe_circular_queue_t event_queue;
+    // One queue per priority lane, consumers always drain the higher lanes first
+    safe_circular_queue_t event_queue[EVENT_NUM_PRIORITY_LANES];
+    // Set whenever anything lands in any of the lanes
+    os_setbits_t event_signal;
     os_status_t eventqueue_status;
+    // Where consumed events land, inline payloads are read out of here and overwritten by the next consume call
+    event_msg_t *landing;
+    int landing_len;
+    // Owner plus every linked subscription, freed when it hits zero
+    int refs;
+    // Set up by local_eventqueue_init_static, none of it gets freed
+    bool static_storage;
+#ifdef EVENT_MANAGEMENT_TRACING
+    // How long events sat in this subscriber's queue, and how deep it got
+    event_trace_hist_t consume_latency;
+    uint32_t depth_max;
+#endif
 } local_event_queue_t;
 
+/**
+ * @brief Dispatch time filter for a subscription
+ * @param const event_data_t *event event about to be delivered, inline payloads are readable through data_ptr
+ * @param void *ctx context pointer handed to subscribe_event_filtered
+ * @return true if the subscriber wants the event
+ * @note Runs on the dispatcher thread, so keep it short and don't block
+ */
+typedef bool (*event_filter_t)(const event_data_t *event, void *ctx);
+
 typedef struct local_event_queue_ll_t
 {
     local_event_queue_t *queue;
     struct local_event_queue_ll_t *next;
+    // Only keep the newest event of this type around, rather than queueing each one
+    bool coalesce;
+    // Guarded by the queue's local_queue_mutex
+    bool coalesce_pending;
+    event_msg_t coalesce_latest;
+    // Optional predicate the dispatcher runs before enqueueing
+    event_filter_t filter;
+    void *filter_ctx;
+    // Unsubscribed, waiting for the dispatcher to reclaim it. Read without a lock, so atomic acquire/release
+    bool removed;
+    // Reclaimed while a coalesced marker still pointed at it, consumer frees it. Guarded by local_queue_mutex
+    bool orphaned;
+    // Chains orphans the consumer is about to free, next belongs to the event type's list
+    struct local_event_queue_ll_t *orphan_next;
 } local_event_queue_ll_t;
 
 typedef void (*event_cb_t)(event_data_t event_id);
 
+/**
+ * @brief A route fixed at compile time, see event_static_routes.h
+ * @note Either queue or event_cb can be NULL. Callbacks run inline on the dispatcher
+ */
+typedef struct event_static_route_t
+{
+    event_type_t event;
+    local_event_queue_t *queue;
+    event_cb_t event_cb;
+} event_static_route_t;
+
+/**
+ * @brief Sees every event the dispatchers hand out, right before fan out
+ * @param const event_msg_t *msg event including it's inline payload
+ * @param void *ctx context pointer handed to event_management_set_tap
+ * @note Runs on the dispatcher threads, several at once when sharded, so keep it short, thread safe and non blocking
+ */
+typedef void (*event_tap_t)(const event_msg_t *msg, void *ctx);
+
 typedef struct event_cb_ll_t
 {
     event_cb_t event_cb;
     struct event_cb_ll_t *next;
+    // Runs on the callback executor instead of the dispatcher
+    bool async;
+    // Sitting in the run queue or being run by a worker, written under the executor lock, atomic so reads pair up
+    bool scheduled;
+    // Events waiting for this callback, only used when async
+    safe_circular_queue_t mailbox;
+    // Detached, waiting for the dispatcher to reclaim it. Read without a lock, so atomic acquire/release
+    bool removed;
+    // Reclaimed while a worker owned it, worker frees it. Guarded by the executor lock
+    bool orphaned;
+    // Events thrown away because the mailbox was full, only used when async
+    uint32_t dropped;
 } event_cb_ll_t;
 
 typedef struct event_type_queue_ll_t
@@ -38,9 +270,26 @@ typedef struct event_type_queue_ll_t
     // Head of linked list of local event queue pointers
     local_event_queue_ll_t *local_event_queue_head;
     event_cb_ll_t *event_cb_queue_head;
+    // Every subscriber of this type only cares about the latest value
+    bool coalesce;
+    // Keep the last published event around for late subscribers, guarded by the shard lock
+    bool retained;
+    bool retained_valid;
+    event_msg_t retained_msg;
+    // Priority lane of this event type, higher is more urgent
+    int priority;
+    // Hands locally published events of this type to a transport, like the shared memory bus
+    event_tap_t forward;
+    void *forward_ctx;
+    // Which dispatcher shard owns this event type
+    int shard;
+#ifdef EVENT_MANAGEMENT_TRACING
+    event_trace_type_t trace;
+#endif
 } event_type_queue_ll_t;
 
 #define EVENT_PEEK_TIMEOUT 0
+#define EVENT_WAIT_FOREVER SAFE_CIRCULAR_WAIT_FOREVER
 
 /**
  * @brief Publish an event to the local eventspace
@@ -48,17 +297,105 @@ typedef struct event_type_queue_ll_t
  * @param event Enumerated type of event
  * @param ptr Random state pointer to be passed between threads
  * @return int
+ * @note If ptr came from event_payload_alloc, the publisher's reference is handed to the bus.
+ * Each subscriber then holds one reference until it calls release_event
  */
 int publish_event(int event, void *ptr);
 
+/**
+ * @brief Publish an event with a small payload copied by value into the event
+ *
+ * @param event Enumerated type of event
+ * @param data pointer to the payload, copied before we return
+ * @param len size of the payload, up to EVENT_INLINE_DATA_MAX bytes
+ * @return int
+ * @note Subscribers get data_ptr pointing at their own copy, valid until their next consume_event.
+ * Callbacks get a copy valid for the duration of the callback
+ */
+int publish_event_inline(int event, const void *data, size_t len);
+
+/**
+ * @brief Publish a group of related events at once
+ *
+ * @param events events to publish, in order. data_ptr works the same as with publish_event
+ * @param num_events up to EVENT_PUBLISH_GROUP_MAX
+ * @return OS_RET_INVALID_PARAM if the events belong to different dispatcher shards or priority lanes
+ * @note The group gets enqueued with a single lock and wakeup, and each subscriber queue gets it's share
+ * of the group back to back, so nobody sees the group interleaved with other events. Coalesced subscriptions
+ * and async callbacks still get their events one by one.
+ * @note The whole group travels in one lane, so every event type in it needs the same
+ * event_management_set_priority. That keeps each type in order with the events of it's type published one by one
+ */
+int publish_events(const event_data_t *events, int num_events);
+
+/**
+ * @brief Publish an inline event that came in from another process
+ * @note Same as publish_event_inline, except forward hooks don't see it, so it never gets sent back out
+ */
+int publish_event_remote(int event, const void *data, size_t len);
+
 /**
  * @brief Thread that will handle all of our event management stuff.
  *
- * @param parameters
- * @note To be handled by our threads_init
+ * @param parameters index of the dispatcher shard this thread services, cast to a pointer. NULL is shard 0
+ * @note To be handled by our threads_init, add one thread per shard(EVENT_MANAGEMENT_NUM_DISPATCHERS)
  */
 void event_management_thread(void *parameters);
 
+/**
+ * @brief Worker thread that runs callbacks attached with attach_event_async
+ *
+ * @param parameters unused
+ * @note To be handled by our threads_init, add as many of these as you want workers in the pool
+ */
+void event_cb_executor_thread(void *parameters);
+
+/**
+ * @brief Tags an event type with a priority lane
+ * @param event_type_t event we are configuring
+ * @param int priority lane, from EVENT_PRIORITY_NORMAL up to EVENT_PRIORITY_URGENT
+ * @note Urgent events skip ahead of every lower lane event in the publish and subscriber queues,
+ * so their latency doesn't depend on how much telemetry is backed up
+ * @note Call before events of that type get published, otherwise in-flight events could get reordered
+ */
+int event_management_set_priority(event_type_t event, int priority);
+
+/**
+ * @brief Installs a tap that sees every dispatched event, used by the event recorder
+ * @param event_tap_t tap NULL removes it
+ * @param void *ctx handed back to the tap
+ * @note Only one tap at a time. A dispatcher that is already inside the old tap can still finish calling it
+ */
+int event_management_set_tap(event_tap_t tap, void *ctx);
+
+/**
+ * @brief Installs a per type forward hook, called by the dispatcher for events of that type published in this process
+ * @param event_tap_t forward NULL removes it
+ * @note Events that came in through publish_event_remote skip it, so two transports forwarding the same type don't ping pong
+ */
+int event_management_set_forward(event_type_t event, event_tap_t forward, void *ctx);
+
+/**
+ * @brief Hands the bus a routing table that was built at compile time
+ * @param const event_static_route_t *routes every route, sorted by event type
+ * @param const uint16_t *route_index EVENT_TYPE_EVENT_END + 1 entries, routes of type n are
+ * routes[route_index[n]] up to routes[route_index[n + 1]]
+ * @note Use EVENT_STATIC_ROUTES from event_static_routes.h rather than building these by hand.
+ * Set it before starting the dispatchers, they walk it without taking any locks.
+ * Static routes go first, then whatever got subscribed at runtime
+ */
+int event_management_set_static_routes(const event_static_route_t *routes, const uint16_t *route_index);
+
+/**
+ * @brief Explicitly map an event type onto a dispatcher shard
+ * @param event_type_t event we are mapping
+ * @param int shard index of the dispatcher, must be less than EVENT_MANAGEMENT_NUM_DISPATCHERS
+ * @note By default events are spread across shards by event id
+ * @return OS_RET_OK, or OS_RET_ALREADY_INITED once a dispatcher thread is running, the mapping is fixed from then on
+ * @note Call before events of that type get published, otherwise in-flight events could get reordered
+ */
+int event_management_set_shard(event_type_t event, int shard);
+
 /**
  * @brief Initialization for event management
  */
@@ -82,14 +419,95 @@ int subscribe_eventlist(local_event_queue_t *local_eventqueue, int *event_list,
  */
 int subscribe_event(local_event_queue_t *local_eventqueue, event_type_t event);
 
+/**
+ * @brief Subscribes to an event, but only the events our filter accepts get delivered
+ * @param local_event_queue_t *local_eventqueue
+ * @param event_type_t event that we are subscribed to
+ * @param event_filter_t filter predicate evaluated by the dispatcher before enqueueing
+ * @param void *filter_ctx passed back into the filter
+ * @note Filtered out events never cost a queue slot, a copy or a wakeup of the consumer
+ */
+int subscribe_event_filtered(local_event_queue_t *local_eventqueue, event_type_t event, event_filter_t filter, void *filter_ctx);
+
+/**
+ * @brief Subscribes to an event, but only the newest value is kept while the consumer is behind
+ * @param local_event_queue_t *local_eventqueue
+ * @param event_type_t event that we are subscribed to
+ * @note A pending event of this type in our queue gets overwritten in place instead of a new one being appended
+ */
+int subscribe_event_coalesced(local_event_queue_t *local_eventqueue, event_type_t event);
+
+/**
+ * @brief Marks an event type as a "current value" type, every subscriber only gets the latest pending value
+ * @param event_type_t event we are configuring
+ * @param bool coalesce whether or not we coalesce
+ */
+int event_management_set_coalesce(event_type_t event, bool coalesce);
+
+/**
+ * @brief Marks an event type as retained(sticky), the bus keeps the last published event of that type
+ * and hands it to every new subscriber as soon as they subscribe
+ * @param event_type_t event we are configuring
+ * @param bool retained whether or not we retain
+ * @note Turning retention off drops the stored event
+ */
+int event_management_set_retained(event_type_t event, bool retained);
+
 /**
  * @brief Attach a callback function to a specific event being called
  * @param local_event_queue_t *local_eventqueue
  * @param event_type_t event that we are subscribed to
  * @param event_cb_t event callback function
+ * @note Runs inline on the dispatcher thread, a slow callback delays every event behind it
  */
 int attach_event(event_type_t event, event_cb_t event_cb);
 
+/**
+ * @brief Attach a callback that runs on the callback executor's worker pool instead of the dispatcher
+ * @param event_type_t event that we are subscribed to
+ * @param event_cb_t event callback function
+ * @note Events are handed to the callback in order and it never runs concurrently with itself.
+ * @note Delivery is lossy, unlike attach_event and subscriber queues. The dispatcher never waits on the callback,
+ * once EVENT_CB_MAILBOX_MAX_SIZE events are pending newer ones are dropped and counted, see event_async_get_dropped.
+ * Size the mailbox for the worst burst, or use attach_event where every event has to be seen
+ * @note Inline payloads point at the worker's copy, valid for the duration of the callback
+ */
+int attach_event_async(event_type_t event, event_cb_t event_cb);
+
+/**
+ * @brief How many events an async callback lost because it's mailbox was full
+ * @param event_type_t event the callback was attached to
+ * @param event_cb_t event callback function
+ * @param uint32_t *dropped filled in with the count since it was attached
+ */
+int event_async_get_dropped(event_type_t event, event_cb_t event_cb, uint32_t *dropped);
+
+/**
+ * @brief Stops delivering an event type to a local eventqueue
+ * @param local_event_queue_t *local_eventqueue
+ * @param event_type_t event that we are unsubscribing from
+ * @note Events already sitting in the queue stay there. The subscription's memory is reclaimed by the
+ * dispatcher once it's no longer walking it, so this is safe to call while events are flowing
+ */
+int unsubscribe_event(local_event_queue_t *local_eventqueue, event_type_t event);
+
+/**
+ * @brief Detaches a callback from an event
+ * @param event_type_t event the callback was attached to
+ * @param event_cb_t event callback function
+ * @note An inline callback may still be running on the dispatcher when this returns,
+ * async callbacks get their pending events dropped
+ */
+int detach_event(event_type_t event, event_cb_t event_cb);
+
+/**
+ * @brief Deletes a local eventqueue, unsubscribing it from everything
+ * @param local_event_queue_t *local_eventqueue created by new_local_eventqueue
+ * @note Pending events are dropped and their payload references released. The memory is
+ * freed once every dispatcher has let go of it, don't touch the queue after calling this
+ */
+int delete_local_eventqueue(local_event_queue_t *local_eventqueue);
+
 /**
  * @brief An eventqueue to subscribe to events from
  * @note It's expected that any worker thread or module will have it's own local eventqueue
@@ -99,6 +517,19 @@ int attach_event(event_type_t event, event_cb_t event_cb);
  */
 local_event_queue_t *new_local_eventqueue(int num_elements_queue);
 
+/**
+ * @brief Storage a statically allocated local eventqueue needs, for every priority lane
+ */
+#define EVENT_LOCAL_QUEUE_STORAGE_LEN(num_elements_queue) (EVENT_NUM_PRIORITY_LANES * (num_elements_queue))
+
+/**
+ * @brief Sets up a local eventqueue on memory we were handed, so nothing gets malloc'd
+ * @param event_msg_t *storage EVENT_LOCAL_QUEUE_STORAGE_LEN(num_elements_queue) messages
+ * @param event_msg_t *landing num_elements_queue messages, where consume_events copies batches to
+ * @note Meant for queues that live forever, don't call delete_local_eventqueue on them
+ */
+int local_eventqueue_init_static(local_event_queue_t *queue, event_msg_t *storage, event_msg_t *landing, int num_elements_queue);
+
 /**
  * @brief Checks to see if there are any events in the currently selected local eventspace
  *
@@ -114,7 +545,90 @@ bool available_events(local_event_queue_t *local_eventqueue);
  * @param eventspace local eventspace index
  * @return event_data_t struct with all our event_data
  * @note Will return the EVENT_TYPE_NONE if there was no actual event returned
+ * @note An inline payload is only valid until the next consume call on this queue, see consume_events
  */
 event_data_t consume_event(local_event_queue_t *local_eventqueue);
+
+/**
+ * @brief Grab a batch of events out of our eventspace, waiting up to a timeout for the first one
+ *
+ * @param local_eventqueue local eventqueue we consume from
+ * @param events array the events get copied into
+ * @param max_events most events we want, capped at the queue size
+ * @param timeout_ms how long to wait if there's nothing there. EVENT_PEEK_TIMEOUT doesn't wait, EVENT_WAIT_FOREVER blocks
+ * @return number of events consumed, 0 if we timed out. Negative os error otherwise
+ * @note Higher priority lanes come first. Every lane has it's own lock, a batch takes the lock of each
+ * non-empty lane once, so a batch out of a single lane costs one lock
+ * @note Inline payloads point into the queue's landing buffer, which the next consume_event or consume_events
+ * call on this queue overwrites. Copy out whatever you need from them before consuming again
+ */
+int consume_events(local_event_queue_t *local_eventqueue, event_data_t *events, int max_events, uint32_t timeout_ms);
+
+/**
+ * @brief Let the bus know we are done with an event we consumed
+ *
+ * @param event event_data_t returned by consume_event
+ * @note Drops our reference on pooled payloads, last subscriber to release puts it back into the pool.
+ * Does nothing for payloads that didn't come from the payload pool
+ */
+int release_event(event_data_t event);
+
+/**
+ * @brief Adds a sample to a log2 histogram, lock free so any thread can record into it
+ * @note Used by the bus tracing and by event_replay, handy for any other latency numbers too
+ */
+void event_trace_hist_record(event_trace_hist_t *hist, uint32_t us);
+
+/**
+ * @brief Summarizes a histogram filled in with event_trace_hist_record
+ * @param event_trace_stats_t *stats filled in with count, p50, p99 and max
+ */
+void event_trace_hist_stats(event_trace_hist_t *hist, event_trace_stats_t *stats);
+
+/**
+ * @brief Event management testing
+ * @note Starts the bus and it's dispatchers if nobody did yet, then runs on the first event type
+ */
+int event_management_unit_test(void);
+
+#ifdef EVENT_MANAGEMENT_TRACING
+/**
+ * @brief Latency summary of one leg of the event path for an event type
+ *
+ * @param event_type_t event we want the numbers for
+ * @param event_trace_stage_t stage which leg of the path
+ * @param event_trace_stats_t *stats filled in with count, p50, p99 and max in microseconds
+ * @note Reads while events keep flowing, so the numbers can be a few events apart from each other
+ */
+int event_trace_get(event_type_t event, event_trace_stage_t stage, event_trace_stats_t *stats);
+
+/**
+ * @brief Queue depth gauges of an event type
+ *
+ * @param uint32_t *publish_depth_max deepest the type's publish lane got, can be NULL
+ * @param uint32_t *subscriber_depth_max deepest any subscriber lane got when one of these got put in it, can be NULL
+ */
+int event_trace_get_depth(event_type_t event, uint32_t *publish_depth_max, uint32_t *subscriber_depth_max);
+
+/**
+ * @brief Latency and depth of a single subscriber, for finding the one that holds everyone else up
+ *
+ * @param event_trace_stats_t *stats how long events sat in the queue before getting consumed
+ * @param uint32_t *depth_max deepest any lane of the queue got, can be NULL
+ */
+int event_trace_queue_get(local_event_queue_t *local_eventqueue, event_trace_stats_t *stats, uint32_t *depth_max);
+
+/**
+ * @brief Zeroes every per type histogram and gauge, subscriber queues keep their own numbers
+ */
+void event_trace_reset(void);
+
+/**
+ * @brief Writes a line per traced event type and stage, plus it's depth gauges
+ *
+ * @param FILE *fp where to write it, stdout works too
+ */
+int event_trace_dump(FILE *fp);
+#endif
 #endif
 #endif
\ No newline at end of file
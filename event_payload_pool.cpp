@@ -0,0 +1,276 @@
+#include "event_payload_pool.h"
+#include "unit_check.h"
+#include "global_includes.h"
+
+#ifndef OS_EVENTQUEUE
+
+// #define EVENT_PAYLOAD_POOL_DEBUGGING
+#ifdef EVENT_PAYLOAD_POOL_DEBUGGING
+#define payload_pool_println(e) os_println(e)
+#else
+#define payload_pool_println(e) (void)e
+#endif
+
+#define EVENT_PAYLOAD_NO_BLOCK (0xFFFF)
+#define EVENT_PAYLOAD_NUM_SLABS 3
+
+/**
+ * @brief Header that sits right in front of every payload block
+ * @note Kept at 8 bytes so the payload after it stays 8 byte aligned
+ */
+typedef struct event_payload_hdr_t
+{
+    int32_t refcount;
+    uint16_t slab_class;
+    uint16_t next_free;
+} event_payload_hdr_t;
+
+typedef struct event_payload_slab_t
+{
+    size_t payload_size;
+    int num_blocks;
+    size_t stride;
+    uint8_t *blocks;
+    // Singly linked free list of block indexes, guarded by the pool mutex
+    uint16_t free_head;
+} event_payload_slab_t;
+
+#define EVENT_PAYLOAD_STRIDE(size) (sizeof(event_payload_hdr_t) + align_up((size), 8))
+
+alignas(8) static uint8_t small_blocks[EVENT_PAYLOAD_SMALL_COUNT * EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_SMALL_SIZE)];
+alignas(8) static uint8_t medium_blocks[EVENT_PAYLOAD_MEDIUM_COUNT * EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_MEDIUM_SIZE)];
+alignas(8) static uint8_t large_blocks[EVENT_PAYLOAD_LARGE_COUNT * EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_LARGE_SIZE)];
+
+// Ordered smallest to largest so allocation picks the tightest fit
+static event_payload_slab_t payload_slabs[EVENT_PAYLOAD_NUM_SLABS] = {
+    {EVENT_PAYLOAD_SMALL_SIZE, EVENT_PAYLOAD_SMALL_COUNT, EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_SMALL_SIZE), small_blocks, EVENT_PAYLOAD_NO_BLOCK},
+    {EVENT_PAYLOAD_MEDIUM_SIZE, EVENT_PAYLOAD_MEDIUM_COUNT, EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_MEDIUM_SIZE), medium_blocks, EVENT_PAYLOAD_NO_BLOCK},
+    {EVENT_PAYLOAD_LARGE_SIZE, EVENT_PAYLOAD_LARGE_COUNT, EVENT_PAYLOAD_STRIDE(EVENT_PAYLOAD_LARGE_SIZE), large_blocks, EVENT_PAYLOAD_NO_BLOCK},
+};
+
+static os_mut_t payload_pool_mut;
+static bool payload_pool_inited = false;
+
+static inline event_payload_hdr_t *payload_block(event_payload_slab_t *slab, int index)
+{
+    return (event_payload_hdr_t *)(slab->blocks + (slab->stride * index));
+}
+
+/**
+ * @brief Gets the header of a pooled payload
+ * @return NULL if the pointer isn't the start of a block in one of our slabs
+ */
+static event_payload_hdr_t *payload_header(const void *payload)
+{
+    if (payload == NULL)
+    {
+        return NULL;
+    }
+
+    // Compared as integers, data_ptr can be any value the publisher likes and doesn't have to point anywhere
+    uintptr_t addr = (uintptr_t)payload - sizeof(event_payload_hdr_t);
+    for (int n = 0; n < EVENT_PAYLOAD_NUM_SLABS; n++)
+    {
+        event_payload_slab_t *slab = &payload_slabs[n];
+        uintptr_t start = (uintptr_t)slab->blocks;
+        uintptr_t end = start + (slab->stride * slab->num_blocks);
+        if (addr < start || addr >= end)
+        {
+            continue;
+        }
+
+        if ((addr - start) % slab->stride != 0)
+        {
+            return NULL;
+        }
+        return (event_payload_hdr_t *)addr;
+    }
+
+    return NULL;
+}
+
+int event_payload_pool_init(void)
+{
+    if (payload_pool_inited)
+    {
+        return OS_RET_ALREADY_INITED;
+    }
+
+    int ret = os_mut_init(&payload_pool_mut);
+    if (ret != OS_RET_OK)
+    {
+        payload_pool_println("Payload pool mutex fail");
+        return ret;
+    }
+    os_mut_exit(&payload_pool_mut);
+
+    // Chain every block of every slab into it's free list
+    for (int n = 0; n < EVENT_PAYLOAD_NUM_SLABS; n++)
+    {
+        event_payload_slab_t *slab = &payload_slabs[n];
+        slab->free_head = EVENT_PAYLOAD_NO_BLOCK;
+        for (int k = slab->num_blocks - 1; k >= 0; k--)
+        {
+            event_payload_hdr_t *hdr = payload_block(slab, k);
+            hdr->refcount = 0;
+            hdr->slab_class = n;
+            hdr->next_free = slab->free_head;
+            slab->free_head = k;
+        }
+    }
+
+    payload_pool_inited = true;
+    return OS_RET_OK;
+}
+
+void *event_payload_alloc(size_t size)
+{
+    if (payload_pool_inited == false || size == 0)
+    {
+        return NULL;
+    }
+
+    os_mut_entry_wait_indefinite(&payload_pool_mut);
+    for (int n = 0; n < EVENT_PAYLOAD_NUM_SLABS; n++)
+    {
+        event_payload_slab_t *slab = &payload_slabs[n];
+        // Too small, or this slab class is all used up, try the next size up
+        if (slab->payload_size < size || slab->free_head == EVENT_PAYLOAD_NO_BLOCK)
+        {
+            continue;
+        }
+
+        event_payload_hdr_t *hdr = payload_block(slab, slab->free_head);
+        slab->free_head = hdr->next_free;
+        os_mut_exit(&payload_pool_mut);
+
+        hdr->next_free = EVENT_PAYLOAD_NO_BLOCK;
+        __atomic_store_n(&hdr->refcount, 1, __ATOMIC_RELEASE);
+        return (void *)(hdr + 1);
+    }
+    os_mut_exit(&payload_pool_mut);
+
+    payload_pool_println("No payload blocks left");
+    return NULL;
+}
+
+int event_payload_retain(void *payload)
+{
+    event_payload_hdr_t *hdr = payload_header(payload);
+    if (hdr == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    __atomic_fetch_add(&hdr->refcount, 1, __ATOMIC_RELAXED);
+    return OS_RET_OK;
+}
+
+int event_payload_release(void *payload)
+{
+    event_payload_hdr_t *hdr = payload_header(payload);
+    if (hdr == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int32_t refcount = __atomic_sub_fetch(&hdr->refcount, 1, __ATOMIC_ACQ_REL);
+    if (refcount > 0)
+    {
+        return OS_RET_OK;
+    }
+
+    if (refcount < 0)
+    {
+        // Someone released more than they retained, don't put it on the free list twice
+        payload_pool_println("Payload released too many times");
+        __atomic_store_n(&hdr->refcount, 0, __ATOMIC_RELAXED);
+        return OS_RET_INT_ERR;
+    }
+
+    // Last reference is gone, back into the pool it goes
+    event_payload_slab_t *slab = &payload_slabs[hdr->slab_class];
+    uint16_t index = ((uint8_t *)hdr - slab->blocks) / slab->stride;
+
+    os_mut_entry_wait_indefinite(&payload_pool_mut);
+    hdr->next_free = slab->free_head;
+    slab->free_head = index;
+    os_mut_exit(&payload_pool_mut);
+
+    return OS_RET_OK;
+}
+
+bool event_payload_is_pooled(const void *payload)
+{
+    return payload_header(payload) != NULL;
+}
+
+int event_payload_refcount(const void *payload)
+{
+    event_payload_hdr_t *hdr = payload_header(payload);
+    if (hdr == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    return __atomic_load_n(&hdr->refcount, __ATOMIC_ACQUIRE);
+}
+
+#ifdef UNIT_CHECK_MODULE
+int event_payload_pool_unit_test(void)
+{
+    unit_test_mod_init();
+
+    int ret = event_payload_pool_init();
+    assert_testcase_equal("Payload pool init", ret == OS_RET_OK || ret == OS_RET_ALREADY_INITED, true);
+
+    void *small = event_payload_alloc(EVENT_PAYLOAD_SMALL_SIZE);
+    assert_testcase_not_null("alloc small payload", small);
+    assert_testcase_equal("small payload refcount", event_payload_refcount(small), 1);
+
+    void *medium = event_payload_alloc(EVENT_PAYLOAD_SMALL_SIZE + 1);
+    assert_testcase_not_null("alloc medium payload", medium);
+    assert_testcase_equal("medium payload pooled", event_payload_is_pooled(medium), true);
+
+    void *too_big = event_payload_alloc(EVENT_PAYLOAD_LARGE_SIZE + 1);
+    assert_testcase_null("alloc oversized payload", too_big);
+
+    int not_pooled;
+    assert_testcase_equal("stack pointer not pooled", event_payload_is_pooled(&not_pooled), false);
+    assert_testcase_equal("release stack pointer", event_payload_release(&not_pooled), OS_RET_INVALID_PARAM);
+
+    // Three subscribers each end up holding a reference
+    event_payload_retain(small);
+    event_payload_retain(small);
+    event_payload_retain(small);
+    event_payload_release(small);
+    assert_testcase_equal("refcount after dispatch", event_payload_refcount(small), 3);
+    event_payload_release(small);
+    event_payload_release(small);
+    event_payload_release(small);
+    assert_testcase_equal("refcount after consume", event_payload_refcount(small), 0);
+
+    // Freed block should be the next one handed out of that slab
+    void *reused = event_payload_alloc(1);
+    assert_testcase_equal("block returned to pool", reused == small, true);
+    event_payload_release(reused);
+    event_payload_release(medium);
+
+    // Drain the large slab completely then make sure we fail cleanly
+    void *large[EVENT_PAYLOAD_LARGE_COUNT];
+    for (int n = 0; n < EVENT_PAYLOAD_LARGE_COUNT; n++)
+    {
+        large[n] = event_payload_alloc(EVENT_PAYLOAD_LARGE_SIZE);
+        assert_testcase_not_null("alloc large payload", large[n]);
+    }
+    assert_testcase_null("large slab exhausted", event_payload_alloc(EVENT_PAYLOAD_LARGE_SIZE));
+    for (int n = 0; n < EVENT_PAYLOAD_LARGE_COUNT; n++)
+    {
+        event_payload_release(large[n]);
+    }
+
+    unit_testcase_end();
+    return OS_RET_OK;
+}
+#endif
+#endif
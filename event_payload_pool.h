@@ -0,0 +1,77 @@
+#ifndef _EVENT_PAYLOAD_POOL_H
+#define _EVENT_PAYLOAD_POOL_H
+
+#include "stdint.h"
+#include "stdlib.h"
+#include "enabled_modules.h"
+
+#ifndef OS_EVENTQUEUE
+
+/**
+ * @brief Slab classes of the payload pool, payload size in bytes and number of blocks for each class
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef EVENT_PAYLOAD_SMALL_SIZE
+#define EVENT_PAYLOAD_SMALL_SIZE 32
+#endif
+#ifndef EVENT_PAYLOAD_SMALL_COUNT
+#define EVENT_PAYLOAD_SMALL_COUNT 32
+#endif
+#ifndef EVENT_PAYLOAD_MEDIUM_SIZE
+#define EVENT_PAYLOAD_MEDIUM_SIZE 128
+#endif
+#ifndef EVENT_PAYLOAD_MEDIUM_COUNT
+#define EVENT_PAYLOAD_MEDIUM_COUNT 16
+#endif
+#ifndef EVENT_PAYLOAD_LARGE_SIZE
+#define EVENT_PAYLOAD_LARGE_SIZE 512
+#endif
+#ifndef EVENT_PAYLOAD_LARGE_COUNT
+#define EVENT_PAYLOAD_LARGE_COUNT 4
+#endif
+
+/**
+ * @brief Initializes the event payload pool
+ * @note Called by event_management_init, all the memory is static so nothing gets malloc'd
+ */
+int event_payload_pool_init(void);
+
+/**
+ * @brief Grabs a payload block out of the smallest slab class that fits
+ * @param size_t size of the payload in bytes
+ * @return pointer to the payload, NULL if there are no free blocks that fit
+ * @note Payload starts with a refcount of 1 owned by the caller. Publishing it hands that reference to the event bus
+ */
+void *event_payload_alloc(size_t size);
+
+/**
+ * @brief Adds a reference to a pooled payload
+ * @param void *payload pointer returned by event_payload_alloc
+ */
+int event_payload_retain(void *payload);
+
+/**
+ * @brief Drops a reference to a pooled payload, block goes back to the pool when it hits zero
+ * @param void *payload pointer returned by event_payload_alloc
+ * @return OS_RET_INVALID_PARAM if the pointer didn't come from the pool
+ */
+int event_payload_release(void *payload);
+
+/**
+ * @brief Checks whether a pointer was handed out by the payload pool
+ */
+bool event_payload_is_pooled(const void *payload);
+
+/**
+ * @brief Current number of references held on a pooled payload
+ * @return refcount, or an os error if the pointer didn't come from the pool
+ */
+int event_payload_refcount(const void *payload);
+
+/**
+ * @brief Event payload pool testing
+ */
+int event_payload_pool_unit_test(void);
+
+#endif
+#endif
@@ -0,0 +1,304 @@
+#include "event_record.h"
+#include "global_includes.h"
+
+#if defined(OS_EVENT_RECORD_MOD) && defined(__linux__) && !defined(OS_EVENTQUEUE)
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// #define EVENT_RECORD_DEBUGGING
+#ifdef EVENT_RECORD_DEBUGGING
+#define event_record_println(e) os_println(e)
+#else
+#define event_record_println(e) (void)e
+#endif
+
+// How many captured events the writer moves into the file per lock
+#define EVENT_RECORD_WRITE_BATCH 32
+
+/**
+ * @brief What the tap hands the writer thread
+ */
+typedef struct event_record_capture_t
+{
+    event_record_entry_t entry;
+    uint8_t payload[EVENT_INLINE_DATA_MAX];
+} event_record_capture_t;
+
+static safe_circular_queue_t capture_queue;
+static bool capture_queue_inited = false;
+// Guards the file, the writer and event_record_stop both write into it
+static os_mut_t record_mut;
+static FILE *record_fp = NULL;
+static uint32_t record_dropped = 0;
+// Set while the writer might be holding captures it dequeued, passes counts finished batches
+static bool record_writer_busy = false;
+static uint32_t record_writer_passes = 0;
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Runs on the dispatchers, so it only copies the event out and never blocks
+ */
+static void event_record_tap(const event_msg_t *msg, void *ctx)
+{
+    event_record_capture_t capture;
+    // Backdated to when it got published, a busy dispatcher picks events up late and would squash the gaps
+    uint32_t since_publish_us = EVENT_TRACE_TIME_US() - msg->publish_us;
+    capture.entry.timestamp_us = monotonic_us() - since_publish_us;
+    capture.entry.event_id = (uint16_t)msg->data.event_id;
+    capture.entry.inline_len = msg->inline_len;
+    capture.entry.flags = msg->inline_len == 0 ? EVENT_RECORD_FLAG_POINTER : 0;
+    memcpy(capture.payload, msg->inline_data.bytes, msg->inline_len);
+
+    if (safe_circular_enqueue(&capture_queue, sizeof(capture), &capture) != OS_RET_OK)
+    {
+        __atomic_fetch_add(&record_dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Writes captured events out, call with record_mut held
+ * @note Captures that show up after the file got closed are counted as dropped
+ */
+static void write_captures(event_record_capture_t *captures, int num)
+{
+    if (record_fp == NULL)
+    {
+        __atomic_fetch_add(&record_dropped, num, __ATOMIC_RELAXED);
+        return;
+    }
+
+    for (int n = 0; n < num; n++)
+    {
+        fwrite(&captures[n].entry, sizeof(event_record_entry_t), 1, record_fp);
+        fwrite(captures[n].payload, 1, captures[n].entry.inline_len, record_fp);
+    }
+}
+
+int event_record_start(const char *path)
+{
+    if (path == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (capture_queue_inited == false)
+    {
+        if (safe_circular_queue_init(&capture_queue, EVENT_RECORD_QUEUE_MAX_SIZE, sizeof(event_record_capture_t)) != OS_RET_OK)
+        {
+            return OS_RET_LOW_MEM_ERROR;
+        }
+        os_mut_init(&record_mut);
+        os_mut_exit(&record_mut);
+        capture_queue_inited = true;
+    }
+
+    os_mut_entry_wait_indefinite(&record_mut);
+    if (record_fp != NULL)
+    {
+        os_mut_exit(&record_mut);
+        event_record_println("Already recording");
+        return OS_RET_INVALID_PARAM;
+    }
+
+    record_fp = fopen(path, "wb");
+    if (record_fp == NULL)
+    {
+        os_mut_exit(&record_mut);
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_record_file_hdr_t hdr;
+    hdr.magic = EVENT_RECORD_MAGIC;
+    hdr.version = EVENT_RECORD_VERSION;
+    hdr.inline_max = EVENT_INLINE_DATA_MAX;
+    fwrite(&hdr, sizeof(hdr), 1, record_fp);
+
+    // Anything a straggling dispatcher tapped after the last stop doesn't belong in this file
+    event_record_capture_t stale;
+    while (safe_circular_dequeue(&capture_queue, sizeof(stale), &stale) == OS_RET_OK)
+    {
+    }
+    __atomic_store_n(&record_dropped, 0, __ATOMIC_RELAXED);
+    os_mut_exit(&record_mut);
+
+    return event_management_set_tap(event_record_tap, NULL);
+}
+
+int event_record_stop(uint32_t *dropped)
+{
+    if (capture_queue_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_management_set_tap(NULL, NULL);
+
+    os_mut_entry_wait_indefinite(&record_mut);
+    if (record_fp == NULL)
+    {
+        os_mut_exit(&record_mut);
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    event_record_capture_t captures[EVENT_RECORD_WRITE_BATCH];
+    int num;
+    while ((num = safe_circular_dequeue_batch_timeout(&capture_queue, sizeof(event_record_capture_t), captures, EVENT_RECORD_WRITE_BATCH, 0)) > 0)
+    {
+        write_captures(captures, num);
+    }
+
+    fclose(record_fp);
+    record_fp = NULL;
+    os_mut_exit(&record_mut);
+
+    // The writer may have grabbed a batch before we drained the queue, let it finish counting it as dropped
+    if (__atomic_load_n(&record_writer_busy, __ATOMIC_SEQ_CST))
+    {
+        uint32_t passes = __atomic_load_n(&record_writer_passes, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&record_writer_busy, __ATOMIC_SEQ_CST) && __atomic_load_n(&record_writer_passes, __ATOMIC_SEQ_CST) == passes)
+        {
+            os_thread_sleep_ms(1);
+        }
+    }
+
+    if (dropped != NULL)
+    {
+        *dropped = __atomic_load_n(&record_dropped, __ATOMIC_RELAXED);
+    }
+    return OS_RET_OK;
+}
+
+void event_record_thread(void *parameters)
+{
+    event_record_capture_t captures[EVENT_RECORD_WRITE_BATCH];
+    for (;;)
+    {
+        if (capture_queue_inited == false)
+        {
+            os_thread_sleep_ms(100);
+            continue;
+        }
+
+        __atomic_store_n(&record_writer_busy, true, __ATOMIC_SEQ_CST);
+        int num = safe_circular_dequeue_batch_timeout(&capture_queue, sizeof(event_record_capture_t), captures, EVENT_RECORD_WRITE_BATCH, 100);
+        if (num > 0)
+        {
+            os_mut_entry_wait_indefinite(&record_mut);
+            write_captures(captures, num);
+            os_mut_exit(&record_mut);
+        }
+        __atomic_fetch_add(&record_writer_passes, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&record_writer_busy, false, __ATOMIC_SEQ_CST);
+    }
+}
+
+int event_replay(const char *path, uint32_t speed, event_replay_stats_t *stats)
+{
+    if (path == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_record_file_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != EVENT_RECORD_MAGIC || hdr.version != EVENT_RECORD_VERSION)
+    {
+        event_record_println("Not an event recording");
+        fclose(fp);
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_replay_stats_t result;
+    memset(&result, 0, sizeof(result));
+    event_trace_hist_t block_hist;
+    memset(&block_hist, 0, sizeof(block_hist));
+
+    uint64_t first_ts_us = 0;
+    uint64_t start_us = monotonic_us();
+    bool first = true;
+
+    event_record_entry_t entry;
+    uint8_t payload[256];
+    while (fread(&entry, sizeof(entry), 1, fp) == 1)
+    {
+        if (entry.inline_len > 0 && fread(payload, 1, entry.inline_len, fp) != entry.inline_len)
+        {
+            event_record_println("Recording got cut off");
+            break;
+        }
+
+        if (entry.event_id >= EVENT_TYPE_EVENT_END || entry.inline_len > EVENT_INLINE_DATA_MAX)
+        {
+            result.events_skipped++;
+            continue;
+        }
+
+        if (first)
+        {
+            first_ts_us = entry.timestamp_us;
+            first = false;
+        }
+
+        // Keep to the recorded schedule, scaled by speed
+        if (speed != EVENT_REPLAY_MAX_SPEED)
+        {
+            uint64_t target_us = start_us + (entry.timestamp_us - first_ts_us) / speed;
+            uint64_t now_us = monotonic_us();
+            if (now_us < target_us)
+            {
+                uint64_t wait_us = target_us - now_us;
+                struct timespec ts;
+                ts.tv_sec = wait_us / 1000000ULL;
+                ts.tv_nsec = (wait_us % 1000000ULL) * 1000;
+                nanosleep(&ts, NULL);
+            }
+            else if (now_us - target_us > result.lateness_max_us)
+            {
+                result.lateness_max_us = (uint32_t)(now_us - target_us);
+            }
+        }
+
+        uint64_t publish_start_us = monotonic_us();
+        if (entry.flags & EVENT_RECORD_FLAG_POINTER)
+        {
+            publish_event(entry.event_id, NULL);
+        }
+        else
+        {
+            publish_event_inline(entry.event_id, payload, entry.inline_len);
+        }
+        event_trace_hist_record(&block_hist, (uint32_t)(monotonic_us() - publish_start_us));
+        result.events_published++;
+    }
+    fclose(fp);
+
+    result.elapsed_us = monotonic_us() - start_us;
+    if (result.elapsed_us > 0)
+    {
+        result.events_per_sec = (uint32_t)((uint64_t)result.events_published * 1000000ULL / result.elapsed_us);
+    }
+    event_trace_stats_t block_stats;
+    event_trace_hist_stats(&block_hist, &block_stats);
+    result.publish_block_p50_us = block_stats.p50_us;
+    result.publish_block_p99_us = block_stats.p99_us;
+    result.publish_block_max_us = block_stats.max_us;
+
+    if (stats != NULL)
+    {
+        *stats = result;
+    }
+    return OS_RET_OK;
+}
+#endif
@@ -0,0 +1,101 @@
+#ifndef _EVENT_RECORD_H
+#define _EVENT_RECORD_H
+
+#include "stdint.h"
+#include "enabled_modules.h"
+#include "event_management.h"
+
+#if defined(OS_EVENT_RECORD_MOD) && defined(__linux__) && !defined(OS_EVENTQUEUE)
+
+/**
+ * @brief How many dispatched events can be waiting for the writer thread before we start dropping them
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef EVENT_RECORD_QUEUE_MAX_SIZE
+#define EVENT_RECORD_QUEUE_MAX_SIZE 1024
+#endif
+
+#define EVENT_RECORD_MAGIC 0x43525645 // "EVRC"
+#define EVENT_RECORD_VERSION 1
+
+// The event carried a pointer payload, which can't be captured, so it gets replayed as NULL
+#define EVENT_RECORD_FLAG_POINTER (1 << 0)
+
+// Replay as fast as the bus takes it
+#define EVENT_REPLAY_MAX_SPEED 0
+
+/**
+ * @brief Start of a recording file
+ */
+typedef struct __attribute__((packed)) event_record_file_hdr_t
+{
+    uint32_t magic;
+    uint16_t version;
+    // EVENT_INLINE_DATA_MAX of whoever recorded it
+    uint16_t inline_max;
+} event_record_file_hdr_t;
+
+/**
+ * @brief Every recorded event, followed by inline_len bytes of payload
+ * @note Timestamps are CLOCK_MONOTONIC microseconds of when the event got published, so replay keeps the
+ * original spacing even if the dispatcher was running behind while recording
+ */
+typedef struct __attribute__((packed)) event_record_entry_t
+{
+    uint64_t timestamp_us;
+    uint16_t event_id;
+    uint8_t inline_len;
+    uint8_t flags;
+} event_record_entry_t;
+
+/**
+ * @brief What a replay run measured
+ * @note Publish block time is only how long publish_event held the replay thread, it climbs once the publish
+ * queue fills up but says nothing about how long events took to reach subscribers. Lateness is how far behind
+ * the recorded schedule we published. Publish to consume latencies are available through event_trace_dump
+ * when EVENT_MANAGEMENT_TRACING is on
+ */
+typedef struct event_replay_stats_t
+{
+    uint32_t events_published;
+    // Unknown event ids, or payloads bigger than we can publish inline
+    uint32_t events_skipped;
+    uint64_t elapsed_us;
+    uint32_t events_per_sec;
+    uint32_t publish_block_p50_us;
+    uint32_t publish_block_p99_us;
+    uint32_t publish_block_max_us;
+    uint32_t lateness_max_us;
+} event_replay_stats_t;
+
+/**
+ * @brief Starts recording every dispatched event into a file
+ * @param const char *path file we (over)write
+ * @note Installs itself as the event_management tap, so only one recording at a time.
+ * Events are written by event_record_thread, if it falls behind events are dropped and counted
+ */
+int event_record_start(const char *path);
+
+/**
+ * @brief Stops recording, writes out whatever is still queued and closes the file
+ * @param uint32_t *dropped how many events never made it into the file, can be NULL
+ */
+int event_record_stop(uint32_t *dropped);
+
+/**
+ * @brief Writer thread, moves captured events into the file
+ * @note Needs to be running while recording
+ */
+void event_record_thread(void *parameters);
+
+/**
+ * @brief Replays a recording into the event bus
+ * @param const char *path recording to replay
+ * @param uint32_t speed 1 for realtime, N for N times faster, EVENT_REPLAY_MAX_SPEED to not wait at all
+ * @param event_replay_stats_t *stats filled in once we're done, can be NULL
+ * @note Blocks the calling thread until the whole file has been published
+ */
+int event_replay(const char *path, uint32_t speed, event_replay_stats_t *stats);
+
+#endif
+#endif
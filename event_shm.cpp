@@ -0,0 +1,379 @@
+#include "event_shm.h"
+#include "global_includes.h"
+
+#if defined(OS_EVENT_SHM_MOD) && defined(__linux__) && !defined(OS_EVENTQUEUE)
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// #define EVENT_SHM_DEBUGGING
+#ifdef EVENT_SHM_DEBUGGING
+#define event_shm_println(e) os_println(e)
+#else
+#define event_shm_println(e) (void)e
+#endif
+
+#if (EVENT_SHM_RING_SIZE & (EVENT_SHM_RING_SIZE - 1)) != 0
+#error "EVENT_SHM_RING_SIZE needs to be a power of 2"
+#endif
+
+#define EVENT_SHM_STATE_EMPTY 0
+#define EVENT_SHM_STATE_FORMATTING 1
+#define EVENT_SHM_STATE_READY 2
+
+// What a process slot's attached word holds, producers only push into LIVE slots
+#define EVENT_SHM_SLOT_FREE 0
+#define EVENT_SHM_SLOT_LIVE 1
+#define EVENT_SHM_SLOT_RESETTING 2
+
+// How long the rx thread sleeps at most before checking if we're detaching
+#define EVENT_SHM_RX_WAIT_MS 100
+
+/**
+ * @brief One event slot. seq tells producers and the consumer who owns it, the rest is the event by value
+ */
+typedef struct event_shm_cell_t
+{
+    uint32_t seq;
+    uint16_t event_id;
+    uint8_t inline_len;
+    uint8_t reserved;
+    uint8_t payload[EVENT_INLINE_DATA_MAX];
+} event_shm_cell_t;
+
+/**
+ * @brief Bounded multiple producer, single consumer ring, one per process
+ * @note Producers claim a slot with a CAS on enqueue_pos and publish it by bumping the slot's seq,
+ * so nobody ever takes a lock that a crashed process could be holding
+ */
+typedef struct event_shm_ring_t
+{
+    alignas(64) uint32_t enqueue_pos;
+    alignas(64) uint32_t dequeue_pos;
+    // Futex the consumer sleeps on, bumped by producers that see it sleeping
+    alignas(64) uint32_t wake_seq;
+    uint32_t sleeping;
+    event_shm_cell_t cells[EVENT_SHM_RING_SIZE];
+} event_shm_ring_t;
+
+typedef struct event_shm_region_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state;
+    uint32_t max_procs;
+    uint32_t ring_size;
+    uint32_t inline_max;
+    uint32_t attached[EVENT_SHM_MAX_PROCS];
+    event_shm_ring_t rings[EVENT_SHM_MAX_PROCS];
+} event_shm_region_t;
+
+static event_shm_region_t *shm_region = NULL;
+static int shm_slot = -1;
+static uint32_t shm_dropped = 0;
+// Lets detach wait for the rx thread to stop touching the region
+static uint32_t rx_active = 0;
+// Dispatchers currently inside event_shm_forward, detach waits for them the same way
+static uint32_t forward_active = 0;
+
+static long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+    // Not FUTEX_PRIVATE, the word lives in memory shared between processes
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static bool ring_push(event_shm_ring_t *ring, const event_msg_t *msg)
+{
+    uint32_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    event_shm_cell_t *cell;
+    for (;;)
+    {
+        cell = &ring->cells[pos & (EVENT_SHM_RING_SIZE - 1)];
+        uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Consumer hasn't freed this slot up yet, ring is full
+            return false;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Copied into the shared slot, the consumer copies it once more when it publishes it into it's own bus
+    cell->event_id = (uint16_t)msg->data.event_id;
+    cell->inline_len = msg->inline_len;
+    memcpy(cell->payload, msg->inline_data.bytes, msg->inline_len);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in the rx thread, either it sees our slot or we see it sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+        futex(&ring->wake_seq, FUTEX_WAKE, 1, NULL);
+    }
+    return true;
+}
+
+/**
+ * @brief Publishes the next event in our ring into the local bus
+ * @return false if the ring was empty
+ */
+static bool ring_pop(event_shm_ring_t *ring)
+{
+    uint32_t pos = ring->dequeue_pos;
+    event_shm_cell_t *cell = &ring->cells[pos & (EVENT_SHM_RING_SIZE - 1)];
+    uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if ((int32_t)(seq - (pos + 1)) < 0)
+    {
+        return false;
+    }
+
+    ring->dequeue_pos = pos + 1;
+    publish_event_remote(cell->event_id, cell->payload, cell->inline_len);
+
+    // Hand the slot back to producers for the next lap
+    __atomic_store_n(&cell->seq, pos + EVENT_SHM_RING_SIZE, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Forward hook, runs on our dispatcher for exported event types
+ */
+static void event_shm_forward(const event_msg_t *msg, void *ctx)
+{
+    // Sequentially consistent against detach, so either we see NULL or it sees us busy
+    __atomic_fetch_add(&forward_active, 1, __ATOMIC_SEQ_CST);
+    event_shm_region_t *region = __atomic_load_n(&shm_region, __ATOMIC_SEQ_CST);
+    if (region == NULL)
+    {
+        __atomic_fetch_sub(&forward_active, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // Payload-less signals cross as zero length events, only real pointers can't
+    bool pointer = msg->inline_len == 0 && msg->data.data_ptr != NULL;
+    for (int n = 0; n < EVENT_SHM_MAX_PROCS; n++)
+    {
+        if (n == shm_slot || __atomic_load_n(&region->attached[n], __ATOMIC_ACQUIRE) != EVENT_SHM_SLOT_LIVE)
+        {
+            continue;
+        }
+
+        if (pointer || ring_push(&region->rings[n], msg) == false)
+        {
+            __atomic_fetch_add(&shm_dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_sub(&forward_active, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Empties a ring, throwing away whatever the last owner of the slot left unread
+ * @note Only safe while no producer pushes into it, so before the slot goes LIVE
+ */
+static void reset_ring(event_shm_ring_t *ring)
+{
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    ring->sleeping = 0;
+    for (uint32_t cell = 0; cell < EVENT_SHM_RING_SIZE; cell++)
+    {
+        ring->cells[cell].seq = cell;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Formats a brand new region, only ever done by whoever won the race for it
+ */
+static void format_region(event_shm_region_t *region)
+{
+    region->magic = EVENT_SHM_MAGIC;
+    region->version = EVENT_SHM_VERSION;
+    region->max_procs = EVENT_SHM_MAX_PROCS;
+    region->ring_size = EVENT_SHM_RING_SIZE;
+    region->inline_max = EVENT_INLINE_DATA_MAX;
+    for (int n = 0; n < EVENT_SHM_MAX_PROCS; n++)
+    {
+        region->attached[n] = EVENT_SHM_SLOT_FREE;
+        region->rings[n].wake_seq = 0;
+        reset_ring(&region->rings[n]);
+    }
+}
+
+int event_shm_attach(const char *name, int proc_slot)
+{
+    if (name == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (proc_slot < 0 || proc_slot >= EVENT_SHM_MAX_PROCS || shm_region != NULL)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+    if (fd < 0)
+    {
+        event_shm_println("Couldn't open shared memory region");
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // Same size for everyone, so whoever truncates first doesn't matter. Fresh pages are zeroed
+    if (ftruncate(fd, sizeof(event_shm_region_t)) != 0)
+    {
+        close(fd);
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
+    event_shm_region_t *region = (event_shm_region_t *)mmap(NULL, sizeof(event_shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
+    uint32_t state = EVENT_SHM_STATE_EMPTY;
+    if (__atomic_compare_exchange_n(&region->state, &state, EVENT_SHM_STATE_FORMATTING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        format_region(region);
+        __atomic_store_n(&region->state, EVENT_SHM_STATE_READY, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&region->state, __ATOMIC_ACQUIRE) != EVENT_SHM_STATE_READY)
+    {
+        os_thread_sleep_ms(1);
+    }
+
+    if (region->magic != EVENT_SHM_MAGIC || region->version != EVENT_SHM_VERSION || region->max_procs != EVENT_SHM_MAX_PROCS ||
+        region->ring_size != EVENT_SHM_RING_SIZE || region->inline_max != EVENT_INLINE_DATA_MAX)
+    {
+        event_shm_println("Shared memory region has a different layout");
+        munmap(region, sizeof(event_shm_region_t));
+        return OS_RET_INVALID_PARAM;
+    }
+
+    uint32_t free_slot = EVENT_SHM_SLOT_FREE;
+    if (__atomic_compare_exchange_n(&region->attached[proc_slot], &free_slot, EVENT_SHM_SLOT_RESETTING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false)
+    {
+        event_shm_println("Process slot already taken");
+        munmap(region, sizeof(event_shm_region_t));
+        return OS_RET_INVALID_PARAM;
+    }
+
+    // Whatever the slot's last owner didn't get to isn't ours, start from an empty ring. Producers skip the
+    // slot until it goes LIVE, so nobody pushes while we reset
+    reset_ring(&region->rings[proc_slot]);
+    __atomic_store_n(&region->attached[proc_slot], EVENT_SHM_SLOT_LIVE, __ATOMIC_RELEASE);
+
+    shm_slot = proc_slot;
+    __atomic_store_n(&shm_region, region, __ATOMIC_RELEASE);
+    return OS_RET_OK;
+}
+
+int event_shm_detach(void)
+{
+    event_shm_region_t *region = shm_region;
+    if (region == NULL)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    __atomic_store_n(&region->attached[shm_slot], EVENT_SHM_SLOT_FREE, __ATOMIC_RELEASE);
+    // Sequentially consistent against rx_active and forward_active, so either they see NULL or we see them busy
+    __atomic_store_n(&shm_region, (event_shm_region_t *)NULL, __ATOMIC_SEQ_CST);
+
+    // Kick the rx thread out of it's futex wait and give it a chance to let go of the region
+    event_shm_ring_t *ring = &region->rings[shm_slot];
+    __atomic_fetch_add(&ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+    futex(&ring->wake_seq, FUTEX_WAKE, 1, NULL);
+    while (__atomic_load_n(&rx_active, __ATOMIC_ACQUIRE))
+    {
+        os_thread_sleep_ms(1);
+    }
+
+    // Dispatchers halfway through forwarding still have the mapping in hand
+    while (__atomic_load_n(&forward_active, __ATOMIC_ACQUIRE))
+    {
+        os_thread_sleep_ms(1);
+    }
+    munmap(region, sizeof(event_shm_region_t));
+    shm_slot = -1;
+    return OS_RET_OK;
+}
+
+int event_shm_unlink(const char *name)
+{
+    if (name == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    return shm_unlink(name) == 0 ? OS_RET_OK : OS_RET_INVALID_PARAM;
+}
+
+int event_shm_export(event_type_t event)
+{
+    return event_management_set_forward(event, event_shm_forward, NULL);
+}
+
+int event_shm_unexport(event_type_t event)
+{
+    return event_management_set_forward(event, NULL, NULL);
+}
+
+uint32_t event_shm_dropped(void)
+{
+    return __atomic_load_n(&shm_dropped, __ATOMIC_RELAXED);
+}
+
+void event_shm_rx_thread(void *parameters)
+{
+    for (;;)
+    {
+        __atomic_store_n(&rx_active, 1, __ATOMIC_SEQ_CST);
+        event_shm_region_t *region = __atomic_load_n(&shm_region, __ATOMIC_SEQ_CST);
+        if (region == NULL)
+        {
+            __atomic_store_n(&rx_active, 0, __ATOMIC_RELEASE);
+            os_thread_sleep_ms(EVENT_SHM_RX_WAIT_MS);
+            continue;
+        }
+
+        event_shm_ring_t *ring = &region->rings[shm_slot];
+        while (ring_pop(ring))
+        {
+        }
+
+        // Announce we're going to sleep, then look one more time so a producer can't slip in between
+        uint32_t wake_seq = __atomic_load_n(&ring->wake_seq, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring_pop(ring) == false && __atomic_load_n(&shm_region, __ATOMIC_ACQUIRE) != NULL)
+        {
+            struct timespec timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_nsec = EVENT_SHM_RX_WAIT_MS * 1000000L;
+            futex(&ring->wake_seq, FUTEX_WAIT, wake_seq, &timeout);
+        }
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&rx_active, 0, __ATOMIC_RELEASE);
+    }
+}
+#endif
@@ -0,0 +1,79 @@
+#ifndef _EVENT_SHM_H
+#define _EVENT_SHM_H
+
+#include "stdint.h"
+#include "enabled_modules.h"
+#include "event_management.h"
+
+#if defined(OS_EVENT_SHM_MOD) && defined(__linux__) && !defined(OS_EVENTQUEUE)
+
+/**
+ * @brief Shared memory bus sizing
+ * @note EVENT_SHM_MAX_PROCS is how many processes can attach to one region, each one gets a ring of
+ * EVENT_SHM_RING_SIZE slots (power of 2) that every other process publishes into.
+ * Every process attaching to the same region needs the same values, attach checks
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef EVENT_SHM_MAX_PROCS
+#define EVENT_SHM_MAX_PROCS 8
+#endif
+#ifndef EVENT_SHM_RING_SIZE
+#define EVENT_SHM_RING_SIZE 256
+#endif
+
+#define EVENT_SHM_MAGIC 0x4D485345 // "ESHM"
+#define EVENT_SHM_VERSION 1
+
+/**
+ * @brief Maps a named shared memory region and claims a process slot in it
+ * @param const char *name shm_open name, like "/csal_events"
+ * @param int proc_slot 0 to EVENT_SHM_MAX_PROCS - 1, unique per process
+ * @return OS_RET_INVALID_PARAM if the slot is taken or the region was made with a different layout
+ * @note Whoever gets there first creates and formats the region. Needs event_management_init first,
+ * and event_shm_rx_thread running to receive anything
+ * @note Our ring starts out empty, events left in it by a previous owner of the slot are thrown away
+ * @note Producers never lock, but one that dies between claiming a slot in our ring and filling it leaves
+ * that slot held. Everything queued behind it stays stuck until we detach and attach again
+ */
+int event_shm_attach(const char *name, int proc_slot);
+
+/**
+ * @brief Gives up our slot and unmaps the region
+ * @note Waits for event_shm_rx_thread and any dispatcher forwarding an event to let go of the region. The region itself
+ * sticks around until someone calls event_shm_unlink
+ */
+int event_shm_detach(void);
+
+/**
+ * @brief Removes the region name, processes that still have it mapped keep working
+ */
+int event_shm_unlink(const char *name);
+
+/**
+ * @brief Sends events of this type published in this process to every other attached process
+ * @note Only inline payloads and events without a payload can cross, pointer payloads mean nothing in
+ * another address space and get dropped.
+ * @note Each event is copied into every peer's ring, then the peer's event_shm_rx_thread copies it out again
+ * into it's own publish queue, from where it fans out like a local publish
+ * @note A peer whose ring is full doesn't hold up our dispatcher, the event is dropped for that peer and counted
+ */
+int event_shm_export(event_type_t event);
+
+/**
+ * @brief Stops sending an event type to other processes
+ */
+int event_shm_unexport(event_type_t event);
+
+/**
+ * @brief How many events we couldn't hand to another process, because it's ring was full or the payload was a pointer
+ */
+uint32_t event_shm_dropped(void);
+
+/**
+ * @brief Receive thread, sleeps on a futex until events land in our ring and publishes them into the local bus
+ * @note Events published here don't get exported again, so processes exporting the same type don't ping pong
+ */
+void event_shm_rx_thread(void *parameters);
+
+#endif
+#endif
@@ -0,0 +1,117 @@
+#ifndef _EVENT_STATIC_ROUTES_H
+#define _EVENT_STATIC_ROUTES_H
+
+#include "event_management.h"
+
+#ifndef OS_EVENTQUEUE
+
+/**
+ * @brief Compile time event routing
+ * @note For firmware where the subscriber graph never changes. Routes get sorted by event type and indexed
+ * by the compiler, so the table ends up const in flash, startup mallocs nothing and the dispatcher
+ * walks it without locks. Needs C++14.
+ *
+ * EVENT_STATIC_QUEUE(sensor_queue, 16);
+ * EVENT_STATIC_ROUTES(app_routes,
+ *                     event_route_queue(EVENT_SENSOR, &sensor_queue),
+ *                     event_route_cb(EVENT_FAULT, fault_handler));
+ *
+ * EVENT_STATIC_QUEUE_INIT(sensor_queue);
+ * EVENT_STATIC_ROUTES_INSTALL(app_routes);
+ */
+
+/**
+ * @brief Declares a local eventqueue along with all of it's storage, nothing is malloc'd
+ * @note Initialize it with EVENT_STATIC_QUEUE_INIT before the dispatchers run
+ */
+#define EVENT_STATIC_QUEUE(name, num_elements_queue)                                     \
+    static event_msg_t name##_storage[EVENT_LOCAL_QUEUE_STORAGE_LEN(num_elements_queue)]; \
+    static event_msg_t name##_landing[num_elements_queue];                                \
+    static local_event_queue_t name
+
+#define EVENT_STATIC_QUEUE_INIT(name) \
+    local_eventqueue_init_static(&name, name##_storage, name##_landing, (int)(sizeof(name##_landing) / sizeof(name##_landing[0])))
+
+/**
+ * @brief Routes every event of a type into a local eventqueue
+ */
+constexpr event_static_route_t event_route_queue(event_type_t event, local_event_queue_t *queue)
+{
+    return event_static_route_t{event, queue, NULL};
+}
+
+/**
+ * @brief Runs a callback inline on the dispatcher for every event of a type
+ */
+constexpr event_static_route_t event_route_cb(event_type_t event, event_cb_t event_cb)
+{
+    return event_static_route_t{event, NULL, event_cb};
+}
+
+/**
+ * @brief Routes sorted by event type, plus where each type starts
+ */
+template <int N>
+struct event_route_table_t
+{
+    event_static_route_t routes[N];
+    uint16_t route_index[EVENT_TYPE_EVENT_END + 1];
+};
+
+template <int N>
+constexpr bool event_routes_valid(const event_static_route_t (&routes)[N])
+{
+    for (int n = 0; n < N; n++)
+    {
+        if ((int)routes[n].event < 0 || (int)routes[n].event >= EVENT_TYPE_EVENT_END)
+        {
+            return false;
+        }
+        if (routes[n].queue == NULL && routes[n].event_cb == NULL)
+        {
+            return false;
+        }
+    }
+    return N < UINT16_MAX;
+}
+
+/**
+ * @brief Sorts the routes by event type, keeping the declared order within a type, and builds the index
+ */
+template <int N>
+constexpr event_route_table_t<N> event_build_route_table(const event_static_route_t (&routes)[N])
+{
+    event_route_table_t<N> table{};
+
+    for (int n = 0; n < N; n++)
+    {
+        table.route_index[(int)routes[n].event + 1]++;
+    }
+    for (int event = 0; event < EVENT_TYPE_EVENT_END; event++)
+    {
+        table.route_index[event + 1] += table.route_index[event];
+    }
+
+    uint16_t fill[EVENT_TYPE_EVENT_END + 1] = {};
+    for (int n = 0; n < N; n++)
+    {
+        int event = (int)routes[n].event;
+        table.routes[table.route_index[event] + fill[event]] = routes[n];
+        fill[event]++;
+    }
+    return table;
+}
+
+/**
+ * @brief Declares a routing table, every argument being an event_route_queue or event_route_cb
+ * @note Queues have to have static storage, so their addresses are known at link time
+ */
+#define EVENT_STATIC_ROUTES(name, ...)                                                                \
+    static constexpr event_static_route_t name##_list[] = {__VA_ARGS__};                             \
+    static_assert(event_routes_valid(name##_list), "Static route with an unknown event or no target"); \
+    static constexpr event_route_table_t<(int)(sizeof(name##_list) / sizeof(name##_list[0]))> name = event_build_route_table(name##_list)
+
+#define EVENT_STATIC_ROUTES_INSTALL(name) event_management_set_static_routes(name.routes, name.route_index)
+
+#endif
+#endif
@@ -0,0 +1,201 @@
+#ifdef EVENT_SHM_EXAMPLE
+#include "../event_shm.h"
+#include "global_includes.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define EVENT_SHM_EXAMPLE_NUM_EVENTS 1000
+#define EVENT_SHM_EXAMPLE_TIMEOUT_MS 2000
+// Most events the parent has in flight, well under EVENT_SHM_RING_SIZE so the child's ring never fills
+#define EVENT_SHM_EXAMPLE_WINDOW 128
+// Child hands credit back every this many events
+#define EVENT_SHM_EXAMPLE_CREDIT_EVERY 32
+
+/**
+ * @brief Inits the bus in this process, attaches to the region and starts the threads that move events
+ */
+static int event_shm_example_start(const char *name, int proc_slot, event_type_t export_event, event_type_t import_event, local_event_queue_t **queue)
+{
+    event_management_init(NULL);
+    int ret = event_shm_attach(name, proc_slot);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
+
+    event_shm_export(export_event);
+    *queue = new_local_eventqueue(64);
+    if (*queue == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+    subscribe_event(*queue, import_event);
+
+    for (intptr_t shard = 0; shard < EVENT_MANAGEMENT_NUM_DISPATCHERS; shard++)
+    {
+        os_add_thread((thread_func_t)event_management_thread, (void *)shard, 0, NULL);
+    }
+    os_add_thread((thread_func_t)event_shm_rx_thread, NULL, 0, NULL);
+    return OS_RET_OK;
+}
+
+/**
+ * @brief Waits for the next event from the other side and copies it's int payload out
+ * @param int *value set to the payload, or -1 for an event without one
+ * @note Inline payloads get overwritten by the next consume, so they are read right here
+ */
+static int event_shm_example_next(local_event_queue_t *queue, int *value)
+{
+    event_data_t event;
+    if (consume_events(queue, &event, 1, EVENT_SHM_EXAMPLE_TIMEOUT_MS) != 1)
+    {
+        return OS_RET_TIMEOUT;
+    }
+
+    *value = event.data_ptr == NULL ? -1 : *(int *)event.data_ptr;
+    return OS_RET_OK;
+}
+
+/**
+ * @brief Child side, checks everything the parent sent came through in order, handing credit back as it goes, then answers
+ */
+static int event_shm_example_child(const char *name, event_type_t parent_event, event_type_t child_event, int ready_fd, int done_fd)
+{
+    local_event_queue_t *queue;
+    if (event_shm_example_start(name, 1, child_event, parent_event, &queue) != OS_RET_OK)
+    {
+        return 1;
+    }
+
+    char c = 'r';
+    if (write(ready_fd, &c, 1) != 1)
+    {
+        return 1;
+    }
+
+    int received = 0;
+    event_data_t events[64];
+    while (received < EVENT_SHM_EXAMPLE_NUM_EVENTS)
+    {
+        int num = consume_events(queue, events, 64, EVENT_SHM_EXAMPLE_TIMEOUT_MS);
+        if (num <= 0)
+        {
+            return 2;
+        }
+
+        for (int n = 0; n < num; n++)
+        {
+            if (*(int *)events[n].data_ptr != received)
+            {
+                return 3;
+            }
+            received++;
+        }
+
+        // Tell the parent how far we got, so it can send more without overrunning our ring
+        if (received % EVENT_SHM_EXAMPLE_CREDIT_EVERY < num && received < EVENT_SHM_EXAMPLE_NUM_EVENTS)
+        {
+            publish_event_inline(child_event, &received, sizeof(received));
+        }
+    }
+
+    // One with a payload and one without, both have to make it across
+    int answer = received;
+    publish_event_inline(child_event, &answer, sizeof(answer));
+    publish_event(child_event, NULL);
+
+    // Stay attached until the parent got our answer
+    if (read(done_fd, &c, 1) != 1)
+    {
+        return 4;
+    }
+    event_shm_detach();
+    return 0;
+}
+
+/**
+ * @brief Forks a second process and sends events through a shared memory region in both directions
+ * @param const char *name shm_open name of the region, like "/csal_shm_example"
+ * @param event_type_t parent_event type the parent sends to the child
+ * @param event_type_t child_event type the child sends back
+ * @return OS_RET_OK if every event crossed in order
+ * @note Call this instead of starting the event bus, both processes set up their own after the fork
+ */
+int test_event_shm_fork(const char *name, event_type_t parent_event, event_type_t child_event)
+{
+    int ready_pipe[2];
+    int done_pipe[2];
+    if (pipe(ready_pipe) != 0 || pipe(done_pipe) != 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    event_shm_unlink(name);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+    if (pid == 0)
+    {
+        _exit(event_shm_example_child(name, parent_event, child_event, ready_pipe[1], done_pipe[0]));
+    }
+
+    int ret = OS_RET_OK;
+    local_event_queue_t *queue;
+    char c = 'd';
+    if (event_shm_example_start(name, 0, parent_event, child_event, &queue) != OS_RET_OK || read(ready_pipe[0], &c, 1) != 1)
+    {
+        ret = OS_RET_INVALID_PARAM;
+    }
+
+    // A full ring drops instead of blocking, so only send as far ahead as the child has given us credit for
+    int acked = 0;
+    for (int n = 0; n < EVENT_SHM_EXAMPLE_NUM_EVENTS && ret == OS_RET_OK; n++)
+    {
+        while (ret == OS_RET_OK && n - acked >= EVENT_SHM_EXAMPLE_WINDOW)
+        {
+            ret = event_shm_example_next(queue, &acked);
+        }
+        publish_event_inline(parent_event, &n, sizeof(n));
+    }
+
+    // Whatever credit is still on it's way, then the answer and the payload-less event
+    int value = 0;
+    int answer = -1;
+    while (ret == OS_RET_OK && value >= 0)
+    {
+        ret = event_shm_example_next(queue, &value);
+        if (value >= 0)
+        {
+            answer = value;
+        }
+    }
+    if (ret == OS_RET_OK && answer != EVENT_SHM_EXAMPLE_NUM_EVENTS)
+    {
+        ret = OS_RET_INVALID_PARAM;
+    }
+
+    if (write(done_pipe[1], &c, 1) != 1)
+    {
+        ret = OS_RET_INVALID_PARAM;
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    os_printf("Child exited with %d, %u events dropped\n", WEXITSTATUS(status), event_shm_dropped());
+    if (WIFEXITED(status) == false || WEXITSTATUS(status) != 0)
+    {
+        ret = OS_RET_INVALID_PARAM;
+    }
+
+    event_shm_detach();
+    event_shm_unlink(name);
+    close(ready_pipe[0]);
+    close(ready_pipe[1]);
+    close(done_pipe[0]);
+    close(done_pipe[1]);
+    return ret;
+}
+
+#endif
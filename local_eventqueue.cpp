@@ -1,7 +1,247 @@
 #include "local_eventqueue.h"
 #include "os_error.h"
+#include "unit_check.h"
+#include "string.h"
+#include "global_includes.h"
 
 #ifndef OS_EVENTQUEUE_LOCAL
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief Makes the eventfd readable for whoever is polling it
+ */
+static void local_eventqueue_poke_fd(local_eventqueue_t *eventqueue)
+{
+    uint64_t one = 1;
+    // Can only fail if the counter is about to overflow, in which case it's readable anyway
+    (void)!write(eventqueue->event_fd, &one, sizeof(one));
+}
+#endif
+
+/**
+ * @brief Claims a ring slot and fills it in
+ * @return false if the ring is full
+ */
+static bool local_eventqueue_ring_push(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    uint32_t pos = __atomic_load_n(&eventqueue->enqueue_pos, __ATOMIC_RELAXED);
+    local_eventqueue_slot_t *slot;
+    for (;;)
+    {
+        slot = &eventqueue->slots[pos & eventqueue->mask];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0)
+        {
+            // Slot is free for this lap, claim it
+            if (__atomic_compare_exchange_n(&eventqueue->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Consumer hasn't gotten to it yet
+            return false;
+        }
+        else
+        {
+            // Another producer got it first
+            pos = __atomic_load_n(&eventqueue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->data = *data;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool local_eventqueue_ring_pop(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    uint32_t pos = eventqueue->dequeue_pos;
+    local_eventqueue_slot_t *slot = &eventqueue->slots[pos & eventqueue->mask];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if ((int32_t)(seq - (pos + 1)) < 0)
+    {
+        return false;
+    }
+
+    *data = slot->data;
+    __atomic_store_n(&eventqueue->dequeue_pos, pos + 1, __ATOMIC_RELAXED);
+    // Free for producers on the next lap
+    __atomic_store_n(&slot->seq, pos + eventqueue->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Whether heap node a has to come out before b
+ */
+static inline bool local_eventqueue_heap_before(local_eventqueue_heap_node_t *a, local_eventqueue_heap_node_t *b)
+{
+    if (a->priority != b->priority)
+    {
+        return a->priority > b->priority;
+    }
+    // Sequence wraps, but never by more than the queue can hold
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static bool local_eventqueue_heap_push(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    // Rank it before taking the lock, it's the caller's code
+    int32_t priority = eventqueue->priority(data);
+
+    os_mut_entry_wait_indefinite(&eventqueue->heap_mutx);
+    if (eventqueue->heap_len == eventqueue->heap_max)
+    {
+        os_mut_exit(&eventqueue->heap_mutx);
+        return false;
+    }
+
+    local_eventqueue_heap_node_t node;
+    node.priority = priority;
+    node.seq = eventqueue->heap_seq++;
+    node.data = *data;
+
+    // Sift up
+    local_eventqueue_heap_node_t *heap = eventqueue->heap;
+    uint32_t n = eventqueue->heap_len++;
+    while (n > 0)
+    {
+        uint32_t parent = (n - 1) / 2;
+        if (!local_eventqueue_heap_before(&node, &heap[parent]))
+        {
+            break;
+        }
+        heap[n] = heap[parent];
+        n = parent;
+    }
+    heap[n] = node;
+
+    __atomic_store_n(&eventqueue->enqueue_pos, eventqueue->enqueue_pos + 1, __ATOMIC_RELAXED);
+    os_mut_exit(&eventqueue->heap_mutx);
+    return true;
+}
+
+static bool local_eventqueue_heap_pop(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    os_mut_entry_wait_indefinite(&eventqueue->heap_mutx);
+    if (eventqueue->heap_len == 0)
+    {
+        os_mut_exit(&eventqueue->heap_mutx);
+        return false;
+    }
+
+    local_eventqueue_heap_node_t *heap = eventqueue->heap;
+    *data = heap[0].data;
+
+    // Sift the last node down from the root
+    uint32_t len = --eventqueue->heap_len;
+    local_eventqueue_heap_node_t last = heap[len];
+    uint32_t n = 0;
+    for (;;)
+    {
+        uint32_t child = 2 * n + 1;
+        if (child >= len)
+        {
+            break;
+        }
+        if (child + 1 < len && local_eventqueue_heap_before(&heap[child + 1], &heap[child]))
+        {
+            child++;
+        }
+        if (!local_eventqueue_heap_before(&heap[child], &last))
+        {
+            break;
+        }
+        heap[n] = heap[child];
+        n = child;
+    }
+    heap[n] = last;
+
+    __atomic_store_n(&eventqueue->dequeue_pos, eventqueue->dequeue_pos + 1, __ATOMIC_RELAXED);
+    os_mut_exit(&eventqueue->heap_mutx);
+    return true;
+}
+
+/**
+ * @brief Tries to put an event in without ever blocking
+ * @return false if the queue is full
+ */
+static bool local_eventqueue_try_push(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    bool pushed = eventqueue->heap != NULL ? local_eventqueue_heap_push(eventqueue, data) : local_eventqueue_ring_push(eventqueue, data);
+    if (!pushed)
+    {
+        return false;
+    }
+
+    // Pairs with the fence in dequeue, either the consumer sees our event or we see it idle
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&eventqueue->consumer_idle, __ATOMIC_RELAXED))
+    {
+        os_setbits_signal(&eventqueue->data_signal, 1);
+    }
+#ifdef __linux__
+    // First producer after the consumer ran dry pokes the eventfd, everyone else skips the syscall
+    if (__atomic_load_n(&eventqueue->fd_armed, __ATOMIC_RELAXED) && __atomic_exchange_n(&eventqueue->fd_armed, 0, __ATOMIC_ACQ_REL))
+    {
+        local_eventqueue_poke_fd(eventqueue);
+    }
+#endif
+    return true;
+}
+
+/**
+ * @brief Takes the next event out if there is one, never blocks
+ */
+static bool local_eventqueue_try_pop(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    bool popped = eventqueue->heap != NULL ? local_eventqueue_heap_pop(eventqueue, data) : local_eventqueue_ring_pop(eventqueue, data);
+    if (!popped)
+    {
+        return false;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&eventqueue->producers_waiting, __ATOMIC_RELAXED))
+    {
+        os_setbits_signal(&eventqueue->space_signal, 1);
+    }
+    return true;
+}
+
+/**
+ * @brief Everything but the storage, shared by both init functions
+ */
+static int local_eventqueue_setup(local_eventqueue_t *eventqueue)
+{
+    eventqueue->enqueue_pos = 0;
+    eventqueue->dequeue_pos = 0;
+    eventqueue->consumer_idle = 0;
+    eventqueue->producers_waiting = 0;
+#ifdef __linux__
+    eventqueue->event_fd = -1;
+    eventqueue->fd_armed = 0;
+#endif
+
+    int ret = os_setbits_init(&eventqueue->data_signal);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
+    os_clearbits(&eventqueue->data_signal, 1);
+
+    ret = os_setbits_init(&eventqueue->space_signal);
+    if (ret != OS_RET_OK)
+    {
+        os_setbits_deconstruct(&eventqueue->data_signal);
+        return ret;
+    }
+    return os_clearbits(&eventqueue->space_signal, 1);
+}
 
 int local_eventqueue_init(local_eventqueue_t *eventqueue, int max_events)
 {
@@ -9,7 +249,113 @@ int local_eventqueue_init(local_eventqueue_t *eventqueue, int max_events)
     {
         return OS_RET_NULL_PTR;
     }
-    return safe_circular_queue_init(&eventqueue->internal_queue, max_events, sizeof(event_data_t));
+
+    if (max_events <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    uint32_t capacity = 1;
+    while (capacity < (uint32_t)max_events)
+    {
+        capacity <<= 1;
+    }
+
+    eventqueue->slots = (local_eventqueue_slot_t *)malloc(sizeof(local_eventqueue_slot_t) * capacity);
+    if (eventqueue->slots == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
+    for (uint32_t n = 0; n < capacity; n++)
+    {
+        eventqueue->slots[n].seq = n;
+    }
+    eventqueue->mask = capacity - 1;
+    eventqueue->heap = NULL;
+
+    int ret = local_eventqueue_setup(eventqueue);
+    if (ret != OS_RET_OK)
+    {
+        free(eventqueue->slots);
+        eventqueue->slots = NULL;
+    }
+    return ret;
+}
+
+int local_eventqueue_init_prio(local_eventqueue_t *eventqueue, int max_events, local_eventqueue_prio_t priority)
+{
+    if (eventqueue == NULL || priority == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (max_events <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    eventqueue->heap = (local_eventqueue_heap_node_t *)malloc(sizeof(local_eventqueue_heap_node_t) * max_events);
+    if (eventqueue->heap == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
+    int ret = os_mut_init(&eventqueue->heap_mutx);
+    if (ret != OS_RET_OK)
+    {
+        free(eventqueue->heap);
+        eventqueue->heap = NULL;
+        return ret;
+    }
+    os_mut_exit(&eventqueue->heap_mutx);
+
+    eventqueue->slots = NULL;
+    eventqueue->mask = 0;
+    eventqueue->priority = priority;
+    eventqueue->heap_len = 0;
+    eventqueue->heap_max = (uint32_t)max_events;
+    eventqueue->heap_seq = 0;
+
+    ret = local_eventqueue_setup(eventqueue);
+    if (ret != OS_RET_OK)
+    {
+        os_mut_deinit(&eventqueue->heap_mutx);
+        free(eventqueue->heap);
+        eventqueue->heap = NULL;
+    }
+    return ret;
+}
+
+int local_eventqueue_deinit(local_eventqueue_t *eventqueue)
+{
+    if (eventqueue == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (eventqueue->slots == NULL && eventqueue->heap == NULL)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+    if (eventqueue->heap != NULL)
+    {
+        free(eventqueue->heap);
+        eventqueue->heap = NULL;
+        os_mut_deinit(&eventqueue->heap_mutx);
+    }
+    free(eventqueue->slots);
+    eventqueue->slots = NULL;
+#ifdef __linux__
+    if (eventqueue->event_fd >= 0)
+    {
+        close(eventqueue->event_fd);
+        eventqueue->event_fd = -1;
+    }
+#endif
+    os_setbits_deconstruct(&eventqueue->data_signal);
+    return os_setbits_deconstruct(&eventqueue->space_signal);
 }
 
 int local_eventqueue_enqueue(local_eventqueue_t *eventqueue, event_data_t data)
@@ -19,37 +365,387 @@ int local_eventqueue_enqueue(local_eventqueue_t *eventqueue, event_data_t data)
         return OS_RET_NULL_PTR;
     }
 
-    return safe_circular_enqueue_notimeout(&eventqueue->internal_queue, sizeof(event_data_t), &data);
+    while (local_eventqueue_try_push(eventqueue, &data) == false)
+    {
+        // Full, let the consumer know somebody needs a wakeup, then look once more before sleeping
+        os_clearbits(&eventqueue->space_signal, 1);
+        __atomic_fetch_add(&eventqueue->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        if (local_eventqueue_try_push(eventqueue, &data))
+        {
+            __atomic_fetch_sub(&eventqueue->producers_waiting, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+
+        int ret = os_waitbits_indefinite(&eventqueue->space_signal, 1);
+        __atomic_fetch_sub(&eventqueue->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+    }
+
+    return OS_RET_OK;
 }
 
 int local_eventqueue_numevents(local_eventqueue_t *eventqueue, int *num_events)
 {
-    if (eventqueue == NULL)
+    if (eventqueue == NULL || num_events == NULL)
     {
         return OS_RET_NULL_PTR;
     }
 
-    *num_events = eventqueue->internal_queue.num_elements_in_queue;
+    uint32_t dequeue_pos = __atomic_load_n(&eventqueue->dequeue_pos, __ATOMIC_RELAXED);
+    uint32_t enqueue_pos = __atomic_load_n(&eventqueue->enqueue_pos, __ATOMIC_RELAXED);
+    int32_t num = (int32_t)(enqueue_pos - dequeue_pos);
+    *num_events = num < 0 ? 0 : num;
     return OS_RET_OK;
 }
 
 int local_eventqueue_peektop(local_eventqueue_t *eventqueue, event_data_t *data)
 {
-    if (eventqueue == NULL)
+    if (eventqueue == NULL || data == NULL)
     {
         return OS_RET_NULL_PTR;
     }
 
-    return safe_circuclar_peektop(&eventqueue->internal_queue, sizeof(event_data_t), data);
+    if (eventqueue->heap != NULL)
+    {
+        int ret = OS_RET_LIST_EMPTY;
+        os_mut_entry_wait_indefinite(&eventqueue->heap_mutx);
+        if (eventqueue->heap_len > 0)
+        {
+            *data = eventqueue->heap[0].data;
+            ret = OS_RET_OK;
+        }
+        os_mut_exit(&eventqueue->heap_mutx);
+        return ret;
+    }
+
+    uint32_t pos = eventqueue->dequeue_pos;
+    local_eventqueue_slot_t *slot = &eventqueue->slots[pos & eventqueue->mask];
+    if ((int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1)) < 0)
+    {
+        return OS_RET_LIST_EMPTY;
+    }
+
+    *data = slot->data;
+    return OS_RET_OK;
 }
 
 int local_eventqueue_dequeue(local_eventqueue_t *eventqueue, event_data_t *data)
 {
-    if (eventqueue == NULL)
+    if (eventqueue == NULL || data == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    while (local_eventqueue_try_pop(eventqueue, data) == false)
+    {
+        // Empty, tell producers we're going idle then look once more so nobody slips in between
+        os_clearbits(&eventqueue->data_signal, 1);
+        __atomic_store_n(&eventqueue->consumer_idle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (local_eventqueue_try_pop(eventqueue, data))
+        {
+            __atomic_store_n(&eventqueue->consumer_idle, 0, __ATOMIC_RELAXED);
+            break;
+        }
+
+        int ret = os_waitbits_indefinite(&eventqueue->data_signal, 1);
+        __atomic_store_n(&eventqueue->consumer_idle, 0, __ATOMIC_RELAXED);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+    }
+
+    return OS_RET_OK;
+}
+
+int local_eventqueue_trydequeue(local_eventqueue_t *eventqueue, event_data_t *data)
+{
+    if (eventqueue == NULL || data == NULL)
     {
         return OS_RET_NULL_PTR;
     }
 
-    return safe_circular_dequeue_notimeout(&eventqueue->internal_queue, sizeof(event_data_t), data);
+    if (local_eventqueue_try_pop(eventqueue, data))
+    {
+        return OS_RET_OK;
+    }
+
+#ifdef __linux__
+    if (eventqueue->event_fd >= 0)
+    {
+        // Ran dry, clear the eventfd and arm it, then look once more in case a producer got in before we armed
+        uint64_t count;
+        (void)!read(eventqueue->event_fd, &count, sizeof(count));
+        __atomic_store_n(&eventqueue->fd_armed, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (local_eventqueue_try_pop(eventqueue, data))
+        {
+            return OS_RET_OK;
+        }
+    }
+#endif
+
+    return OS_RET_LIST_EMPTY;
+}
+
+#ifdef __linux__
+int local_eventqueue_get_fd(local_eventqueue_t *eventqueue, int *fd)
+{
+    if (eventqueue == NULL || fd == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (eventqueue->event_fd < 0)
+    {
+        int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0)
+        {
+            return OS_RET_IO_ERROR;
+        }
+        eventqueue->event_fd = event_fd;
+
+        __atomic_store_n(&eventqueue->fd_armed, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // Anything that was already sitting there has to show up as readable too
+        int num_events = 0;
+        local_eventqueue_numevents(eventqueue, &num_events);
+        if (num_events > 0 && __atomic_exchange_n(&eventqueue->fd_armed, 0, __ATOMIC_ACQ_REL))
+        {
+            local_eventqueue_poke_fd(eventqueue);
+        }
+    }
+
+    *fd = eventqueue->event_fd;
+    return OS_RET_OK;
+}
+#endif
+
+#ifdef LOCAL_EVENTQUEUE_BENCHMARK
+#include "safe_circular_queue.h"
+#include <stdio.h>
+
+#define LOCAL_EVENTQUEUE_BENCHMARK_EVENTS 200000
+#define LOCAL_EVENTQUEUE_BENCHMARK_SIZE 1024
+
+typedef struct local_eventqueue_bench_t
+{
+    local_eventqueue_t eventqueue;
+    safe_circular_queue_t baseline;
+    bool use_baseline;
+    int events_per_producer;
+    // Bumped by each producer as the very last thing it does
+    uint32_t producers_done;
+} local_eventqueue_bench_t;
+
+static void local_eventqueue_bench_producer(void *params)
+{
+    local_eventqueue_bench_t *bench = (local_eventqueue_bench_t *)params;
+
+    event_data_t data;
+    data.event_id = (event_type_t)0;
+    for (int n = 0; n < bench->events_per_producer; n++)
+    {
+        data.data_ptr = (void *)(intptr_t)n;
+        if (bench->use_baseline)
+        {
+            safe_circular_enqueue_notimeout(&bench->baseline, sizeof(data), &data);
+        }
+        else
+        {
+            local_eventqueue_enqueue(&bench->eventqueue, data);
+        }
+    }
+    __atomic_fetch_add(&bench->producers_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Pushes LOCAL_EVENTQUEUE_BENCHMARK_EVENTS through a queue from num_producers threads
+ * @return events per millisecond the consumer got through
+ */
+static uint64_t local_eventqueue_bench_run(local_eventqueue_bench_t *bench, int num_producers)
+{
+    bench->events_per_producer = LOCAL_EVENTQUEUE_BENCHMARK_EVENTS / num_producers;
+    int total = bench->events_per_producer * num_producers;
+    bench->producers_done = 0;
+
+    uint64_t start_ms = get_current_time_millis();
+    for (int n = 0; n < num_producers; n++)
+    {
+        os_add_thread(local_eventqueue_bench_producer, bench, 8192, NULL);
+    }
+
+    event_data_t data;
+    for (int n = 0; n < total; n++)
+    {
+        if (bench->use_baseline)
+        {
+            safe_circular_dequeue_notimeout(&bench->baseline, sizeof(data), &data);
+        }
+        else
+        {
+            local_eventqueue_dequeue(&bench->eventqueue, &data);
+        }
+    }
+
+    uint64_t elapsed_ms = get_current_time_millis() - start_ms;
+
+    // The last producer can still be inside enqueue signalling us, wait it out before the queue gets torn down
+    while (__atomic_load_n(&bench->producers_done, __ATOMIC_ACQUIRE) < (uint32_t)num_producers)
+    {
+        os_thread_sleep_ms(1);
+    }
+    return total / (elapsed_ms > 0 ? elapsed_ms : 1);
+}
+
+void local_eventqueue_benchmark(void)
+{
+    static local_eventqueue_bench_t bench;
+    char line[96];
+
+    os_println((char *)"producers  mpsc_events_per_ms  safe_circular_events_per_ms");
+    for (int num_producers = 1; num_producers <= 16; num_producers *= 2)
+    {
+        local_eventqueue_init(&bench.eventqueue, LOCAL_EVENTQUEUE_BENCHMARK_SIZE);
+        bench.use_baseline = false;
+        uint64_t mpsc = local_eventqueue_bench_run(&bench, num_producers);
+        local_eventqueue_deinit(&bench.eventqueue);
+
+        safe_circular_queue_init(&bench.baseline, LOCAL_EVENTQUEUE_BENCHMARK_SIZE, sizeof(event_data_t));
+        bench.use_baseline = true;
+        uint64_t baseline = local_eventqueue_bench_run(&bench, num_producers);
+        safe_circular_deinit(&bench.baseline);
+
+        snprintf(line, sizeof(line), "%9d  %18llu  %27llu", num_producers, (unsigned long long)mpsc, (unsigned long long)baseline);
+        os_println(line);
+    }
+}
+#endif
+
+#ifdef UNIT_CHECK_MODULE
+static local_eventqueue_t unit_eventqueue;
+
+static event_data_t local_eventqueue_unit_event(intptr_t value)
+{
+    event_data_t data;
+    memset(&data, 0, sizeof(data));
+    data.data_ptr = (void *)value;
+    return data;
+}
+
+// Ranks a test event by it's tens, so equal tens exercise the arrival order tiebreak
+static int local_eventqueue_unit_prio(const event_data_t *data)
+{
+    return (int)((intptr_t)data->data_ptr / 10);
+}
+
+int local_eventqueue_unit_test(void)
+{
+    unit_test_mod_init();
+
+    // Rounded up to 8
+    int ret = local_eventqueue_init(&unit_eventqueue, 5);
+    assert_testcase_equal("Eventqueue init", ret, OS_RET_OK);
+
+    event_data_t data;
+    for (intptr_t n = 0; n < 8; n++)
+    {
+        data = local_eventqueue_unit_event(n);
+        assert_testcase_equal("enqueue until full", local_eventqueue_try_push(&unit_eventqueue, &data), true);
+    }
+    data = local_eventqueue_unit_event(8);
+    assert_testcase_equal("enqueue when full", local_eventqueue_try_push(&unit_eventqueue, &data), false);
+
+    int num_events = 0;
+    local_eventqueue_numevents(&unit_eventqueue, &num_events);
+    assert_testcase_equal("numevents when full", num_events, 8);
+    local_eventqueue_peektop(&unit_eventqueue, &data);
+    assert_testcase_equal("peektop is the oldest", (int)(intptr_t)data.data_ptr, 0);
+
+    for (intptr_t n = 0; n < 8; n++)
+    {
+        ret = local_eventqueue_trydequeue(&unit_eventqueue, &data);
+        assert_testcase_equal("dequeue in order", ret == OS_RET_OK && (intptr_t)data.data_ptr == n, true);
+    }
+    assert_testcase_equal("dequeue when empty", local_eventqueue_trydequeue(&unit_eventqueue, &data), OS_RET_LIST_EMPTY);
+
+    // Park both positions right below the 32 bit wrap, every slot's seq has to agree with where it sits in the lap
+    uint32_t wrap_pos = UINT32_MAX - 2;
+    for (uint32_t n = 0; n <= unit_eventqueue.mask; n++)
+    {
+        unit_eventqueue.slots[(wrap_pos + n) & unit_eventqueue.mask].seq = wrap_pos + n;
+    }
+    unit_eventqueue.enqueue_pos = wrap_pos;
+    unit_eventqueue.dequeue_pos = wrap_pos;
+
+    // One at a time first, so the queue has to look empty right on the wrap
+    for (intptr_t n = 0; n < 6; n++)
+    {
+        data = local_eventqueue_unit_event(50 + n);
+        local_eventqueue_try_push(&unit_eventqueue, &data);
+        ret = local_eventqueue_trydequeue(&unit_eventqueue, &data);
+        assert_testcase_equal("single event across the wrap", ret == OS_RET_OK && (intptr_t)data.data_ptr == 50 + n, true);
+        assert_testcase_equal("empty on the wrap", local_eventqueue_trydequeue(&unit_eventqueue, &data), OS_RET_LIST_EMPTY);
+    }
+
+    for (intptr_t n = 0; n < 8; n++)
+    {
+        data = local_eventqueue_unit_event(100 + n);
+        assert_testcase_equal("enqueue across the wrap", local_eventqueue_try_push(&unit_eventqueue, &data), true);
+    }
+    data = local_eventqueue_unit_event(108);
+    assert_testcase_equal("full across the wrap", local_eventqueue_try_push(&unit_eventqueue, &data), false);
+    for (intptr_t n = 0; n < 8; n++)
+    {
+        ret = local_eventqueue_trydequeue(&unit_eventqueue, &data);
+        assert_testcase_equal("dequeue across the wrap", ret == OS_RET_OK && (intptr_t)data.data_ptr == 100 + n, true);
+    }
+    assert_testcase_equal("empty across the wrap", local_eventqueue_trydequeue(&unit_eventqueue, &data), OS_RET_LIST_EMPTY);
+
+    ret = local_eventqueue_deinit(&unit_eventqueue);
+    assert_testcase_equal("Eventqueue deinit", ret, OS_RET_OK);
+
+    ret = local_eventqueue_init_prio(&unit_eventqueue, 6, local_eventqueue_unit_prio);
+    assert_testcase_equal("Priority eventqueue init", ret, OS_RET_OK);
+
+    intptr_t heap_in[6] = {1, 25, 12, 27, 3, 21};
+    intptr_t heap_out[6] = {25, 27, 21, 12, 1, 3};
+    for (int n = 0; n < 6; n++)
+    {
+        data = local_eventqueue_unit_event(heap_in[n]);
+        assert_testcase_equal("priority enqueue", local_eventqueue_try_push(&unit_eventqueue, &data), true);
+    }
+    data = local_eventqueue_unit_event(99);
+    assert_testcase_equal("priority enqueue when full", local_eventqueue_try_push(&unit_eventqueue, &data), false);
+    for (int n = 0; n < 6; n++)
+    {
+        ret = local_eventqueue_trydequeue(&unit_eventqueue, &data);
+        assert_testcase_equal("highest priority, then oldest", ret == OS_RET_OK && (intptr_t)data.data_ptr == heap_out[n], true);
+    }
+    assert_testcase_equal("priority dequeue when empty", local_eventqueue_trydequeue(&unit_eventqueue, &data), OS_RET_LIST_EMPTY);
+
+    // Arrival order has to hold while the sequence counter wraps
+    unit_eventqueue.heap_seq = UINT32_MAX - 1;
+    for (intptr_t n = 0; n < 4; n++)
+    {
+        data = local_eventqueue_unit_event(40 + n);
+        local_eventqueue_try_push(&unit_eventqueue, &data);
+    }
+    for (intptr_t n = 0; n < 4; n++)
+    {
+        ret = local_eventqueue_trydequeue(&unit_eventqueue, &data);
+        assert_testcase_equal("equal priority across the seq wrap", ret == OS_RET_OK && (intptr_t)data.data_ptr == 40 + n, true);
+    }
+
+    ret = local_eventqueue_deinit(&unit_eventqueue);
+    assert_testcase_equal("Priority eventqueue deinit", ret, OS_RET_OK);
+
+    unit_testcase_end();
+    return OS_RET_OK;
 }
-#endif
\ No newline at end of file
+#endif
+#endif
@@ -1,28 +1,125 @@
 #ifndef _LOCAL_EVENTQUEUE_H
 #define _LOCAL_EVENTQUEUE_H
 
-#include "safe_circular_queue.h"
+#include "os_setbits.h"
+#include "os_error.h"
 #include "event_type_list.h"
 #include "enabled_modules.h"
+#include "os_mutx.h"
 
 #ifndef OS_EVENTQUEUE_LOCAL
+
+/**
+ * @brief Alignment that keeps the producer and consumer positions off each other's cache line
+ * @note Padding each one out costs a few hundred bytes per queue, so it defaults to 1 (no padding) off Linux,
+ * where targets are mostly single core or cacheless. Can be overridden in enabled_modules.h
+ * @note Only holds if the queue itself is aligned, static and stack queues are, a plain malloc might not be
+ */
+#ifndef LOCAL_EVENTQUEUE_CACHELINE
+#ifdef __linux__
+#define LOCAL_EVENTQUEUE_CACHELINE 64
+#else
+#define LOCAL_EVENTQUEUE_CACHELINE 1
+#endif
+#endif
+
+#if LOCAL_EVENTQUEUE_CACHELINE > 1
+#define LOCAL_EVENTQUEUE_CACHE_ALIGNED alignas(LOCAL_EVENTQUEUE_CACHELINE)
+#else
+#define LOCAL_EVENTQUEUE_CACHE_ALIGNED
+#endif
+
+/**
+ * @brief One slot of the ring, seq says whether producers or the consumer own it
+ */
+typedef struct local_eventqueue_slot
+{
+    uint32_t seq;
+    event_data_t data;
+} local_eventqueue_slot_t;
+
+/**
+ * @brief Tells a priority eventqueue how urgent an event is, higher comes out first
+ */
+typedef int (*local_eventqueue_prio_t)(const event_data_t *data);
+
+/**
+ * @brief One entry of a priority eventqueue's heap
+ */
+typedef struct local_eventqueue_heap_node
+{
+    int32_t priority;
+    // Arrival order, breaks ties between equal priorities
+    uint32_t seq;
+    event_data_t data;
+} local_eventqueue_heap_node_t;
+
+/**
+ * @brief Bounded multiple producer, single consumer eventqueue
+ * @note Producers claim slots with a CAS and never take a lock, the consumer never waits on a producer.
+ * The signals only get used when the consumer is idle on an empty queue, or producers on a full one
+ */
 typedef struct local_eventqueue
 {
-    safe_circular_queue_t internal_queue;
+    local_eventqueue_slot_t *slots;
+    // Capacity rounded up to a power of 2, minus one
+    uint32_t mask;
+
+    // Producer and consumer positions on their own cache lines so they don't bounce, see LOCAL_EVENTQUEUE_CACHELINE
+    LOCAL_EVENTQUEUE_CACHE_ALIGNED uint32_t enqueue_pos;
+    LOCAL_EVENTQUEUE_CACHE_ALIGNED uint32_t dequeue_pos;
+
+    // Consumer is (about to be) blocked on data_signal
+    LOCAL_EVENTQUEUE_CACHE_ALIGNED uint32_t consumer_idle;
+    // Producers blocked on space_signal because we were full
+    uint32_t producers_waiting;
+    os_setbits_t data_signal;
+    os_setbits_t space_signal;
+
+    // Only set up by local_eventqueue_init_prio, slots is NULL then
+    local_eventqueue_heap_node_t *heap;
+    local_eventqueue_prio_t priority;
+    uint32_t heap_len;
+    uint32_t heap_max;
+    uint32_t heap_seq;
+    os_mut_t heap_mutx;
+
+#ifdef __linux__
+    // eventfd from local_eventqueue_get_fd, -1 until someone asks for one
+    int event_fd;
+    // Consumer found the queue empty and wants the next producer to poke event_fd
+    uint32_t fd_armed;
+#endif
 } local_eventqueue_t;
 
 /**
  * @brief Initializes our local eventqueue
  * @param local_eventqueue_t *eventqueue pointer to eventqueue
- * @param event_data_t *data pointer to data
-
+ * @param int max_events how many events fit, rounded up to a power of 2
 */
 int local_eventqueue_init(local_eventqueue_t *eventqueue, int max_events);
 
+/**
+ * @brief Initializes an eventqueue that hands out the most urgent event first, then the oldest of equal priority
+ * @param local_eventqueue_t *eventqueue pointer to eventqueue
+ * @param int max_events how many events fit
+ * @param local_eventqueue_prio_t priority called on every enqueue to rank the event
+ * @note Backed by a binary heap under a mutex, so enqueue and dequeue are O(log n) and producers can contend.
+ * The rest of the local_eventqueue API works the same on it
+ */
+int local_eventqueue_init_prio(local_eventqueue_t *eventqueue, int max_events, local_eventqueue_prio_t priority);
+
+/**
+ * @brief Frees the eventqueue's storage
+ * @note Nobody can be enqueueing or dequeueing anymore
+ */
+int local_eventqueue_deinit(local_eventqueue_t *eventqueue);
+
 /**
  * @brief Enqueues an event to our local evenqueue
  * @param local_eventqueue_t *eventqueue pointer to eventqueue
  * @param event_data_t data to enqueue
+ * @note Lock free, only blocks when the queue is full
  */
 int local_eventqueue_enqueue(local_eventqueue_t *eventqueue, event_data_t data);
 
@@ -30,13 +127,14 @@ int local_eventqueue_enqueue(local_eventqueue_t *eventqueue, event_data_t data);
  * @brief Checks how many events are inside the local eventqueue
  * @param local_eventqueue_t *eventqueue pointer to eventqueue
  * @param int *num events pointer to number to set to number of event
+ * @note Producers can be mid enqueue, so treat it as a rough number
  */
 int local_eventqueue_numevents(local_eventqueue_t *eventqueue, int *num_events);
 
 /**
  * @brief Checks the top of the eventquueue, pulls down that data
  * @param local_eventqueue_t *eventqueue pointer to eventqueue
-
+ * @note Consumer only
 */
 int local_eventqueue_peektop(local_eventqueue_t *eventqueue, event_data_t *data);
 
@@ -44,7 +142,42 @@ int local_eventqueue_peektop(local_eventqueue_t *eventqueue, event_data_t *data)
  * @brief Gets topmost element from the queue.
  * @param local_eventqueue_t *eventqueue pointer to eventqueue
  * @param event_data_t *data pointer to data
+ * @note Consumer only. Blocks while the queue is empty
  */
 int local_eventqueue_dequeue(local_eventqueue_t *eventqueue, event_data_t *data);
+
+/**
+ * @brief Gets the topmost element without blocking
+ * @param local_eventqueue_t *eventqueue pointer to eventqueue
+ * @param event_data_t *data pointer to data
+ * @return OS_RET_LIST_EMPTY if there was nothing in there
+ * @note Consumer only
+ */
+int local_eventqueue_trydequeue(local_eventqueue_t *eventqueue, event_data_t *data);
+
+#ifdef __linux__
+/**
+ * @brief Gets an eventfd that polls readable while events are pending, so the queue can sit in an epoll loop next to sockets and timers
+ * @param local_eventqueue_t *eventqueue pointer to eventqueue
+ * @param int *fd set to the eventfd, owned by the queue and closed in local_eventqueue_deinit
+ * @note Created on the first call, queues that never ask don't pay for it. When it polls readable, call
+ * local_eventqueue_trydequeue until it returns OS_RET_LIST_EMPTY, that's what rearms the fd.
+ * Producers only write to it when the consumer has drained everything, not on every enqueue
+ */
+int local_eventqueue_get_fd(local_eventqueue_t *eventqueue, int *fd);
+#endif
+
+#ifdef LOCAL_EVENTQUEUE_BENCHMARK
+/**
+ * @brief Enqueue contention benchmark with 1 to 16 producers against one consumer, printed with os_println
+ * @note Runs the safe_circular_queue the eventqueue used to sit on top of as a baseline
+ */
+void local_eventqueue_benchmark(void);
+#endif
+
+/**
+ * @brief Local eventqueue testing
+ */
+int local_eventqueue_unit_test(void);
+#endif
 #endif
-#endif
\ No newline at end of file
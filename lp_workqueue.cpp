@@ -1,13 +1,556 @@
 #include "platform_cshal.h"
 
 #include "lp_workqueue.h"
+#include "unit_check.h"
 #include "os_error.h"
 #include "stdlib.h"
+#include "string.h"
 #include "os_mutx.h"
+#include "os_setbits.h"
 #include "enabled_modules.h"
 
 #ifdef OS_LP_WORKQUEUE_MOD
 
+static inline uint64_t lp_workqueue_level_shift(int level)
+{
+    return (uint64_t)(LP_WORKQUEUE_WHEEL_BITS * level);
+}
+
+static void lp_workqueue_list_add(lp_workqueue_t *wq, lp_workqueue_func_node_t *node, int slot)
+{
+    node->prev = NULL;
+    node->next = wq->wheel[slot];
+    if (node->next != NULL)
+    {
+        node->next->prev = node;
+    }
+    wq->wheel[slot] = node;
+    node->wheel_slot = slot;
+
+    if (slot < LP_WORKQUEUE_DUE_LIST)
+    {
+        wq->occupied[slot / LP_WORKQUEUE_WHEEL_SLOTS] |= 1ULL << (slot % LP_WORKQUEUE_WHEEL_SLOTS);
+    }
+}
+
+static void lp_workqueue_list_unlink(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    int slot = node->wheel_slot;
+    if (node->prev != NULL)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        wq->wheel[slot] = node->next;
+    }
+    if (node->next != NULL)
+    {
+        node->next->prev = node->prev;
+    }
+    node->wheel_slot = -1;
+
+    if (slot < LP_WORKQUEUE_DUE_LIST && wq->wheel[slot] == NULL)
+    {
+        wq->occupied[slot / LP_WORKQUEUE_WHEEL_SLOTS] &= ~(1ULL << (slot % LP_WORKQUEUE_WHEEL_SLOTS));
+    }
+}
+
+/**
+ * @brief Files a node under the lowest level whose window, relative to wheel_ms, still holds it's deadline
+ */
+static void lp_workqueue_wheel_insert(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    // Anything already overdue goes out on the next tick
+    uint64_t expires = node->next_ms < wq->wheel_ms ? wq->wheel_ms : node->next_ms;
+
+    int level = 0;
+    while (level < LP_WORKQUEUE_WHEEL_LEVELS - 1 &&
+           (expires >> lp_workqueue_level_shift(level + 1)) != (wq->wheel_ms >> lp_workqueue_level_shift(level + 1)))
+    {
+        level++;
+    }
+
+    int slot = (int)((expires >> lp_workqueue_level_shift(level)) & (LP_WORKQUEUE_WHEEL_SLOTS - 1));
+    lp_workqueue_list_add(wq, node, level * LP_WORKQUEUE_WHEEL_SLOTS + slot);
+
+    if (expires < wq->wake_ms)
+    {
+        // Sooner than the workqueue thread is planning to wake up, get it to look again. Once is enough
+        wq->wake_ms = 0;
+        os_setbits_signal(&wq->wake_signal, 1);
+    }
+}
+
+/**
+ * @brief Finds the next tick where a slot has to be expired or cascaded
+ * @return false if the wheel is empty
+ */
+static bool lp_workqueue_wheel_next_tick(lp_workqueue_t *wq, uint64_t *tick)
+{
+    bool found = false;
+    for (int level = 0; level < LP_WORKQUEUE_WHEEL_LEVELS; level++)
+    {
+        uint64_t bits = wq->occupied[level];
+        if (bits == 0)
+        {
+            continue;
+        }
+
+        uint64_t shift = lp_workqueue_level_shift(level);
+        uint64_t lap = 1ULL << (shift + LP_WORKQUEUE_WHEEL_BITS);
+        uint64_t base = wq->wheel_ms & ~(lap - 1);
+        int cur = (int)((wq->wheel_ms >> shift) & (LP_WORKQUEUE_WHEEL_SLOTS - 1));
+
+        // The slot we're in is still pending if we sit right on it's boundary, otherwise it's been handled
+        bool cur_pending = (wq->wheel_ms & ((1ULL << shift) - 1)) == 0;
+        uint64_t ahead = cur_pending ? ~0ULL << cur : (cur == LP_WORKQUEUE_WHEEL_SLOTS - 1 ? 0 : ~0ULL << (cur + 1));
+
+        uint64_t candidate;
+        if ((bits & ahead) != 0)
+        {
+            candidate = base + ((uint64_t)__builtin_ctzll(bits & ahead) << shift);
+        }
+        else
+        {
+            // Only far out items in the top level can be behind us, they come around next lap
+            candidate = base + lap + ((uint64_t)__builtin_ctzll(bits) << shift);
+        }
+
+        if (!found || candidate < *tick)
+        {
+            *tick = candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Processes one tick, cascading coarser slots down on their boundaries and moving what expires to the due list
+ */
+static void lp_workqueue_wheel_step(lp_workqueue_t *wq, uint64_t tick)
+{
+    wq->wheel_ms = tick;
+
+    // Coarsest first, so whatever it cascades into a finer slot that's due now is picked up right after
+    for (int level = LP_WORKQUEUE_WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        uint64_t shift = lp_workqueue_level_shift(level);
+        if ((tick & ((1ULL << shift) - 1)) != 0)
+        {
+            continue;
+        }
+
+        int slot = level * LP_WORKQUEUE_WHEEL_SLOTS + (int)((tick >> shift) & (LP_WORKQUEUE_WHEEL_SLOTS - 1));
+        lp_workqueue_func_node_t *node = wq->wheel[slot];
+        wq->wheel[slot] = NULL;
+        wq->occupied[level] &= ~(1ULL << (slot % LP_WORKQUEUE_WHEEL_SLOTS));
+        while (node != NULL)
+        {
+            lp_workqueue_func_node_t *next = node->next;
+            lp_workqueue_wheel_insert(wq, node);
+            node = next;
+        }
+    }
+
+    int slot = (int)(tick & (LP_WORKQUEUE_WHEEL_SLOTS - 1));
+    lp_workqueue_func_node_t *node = wq->wheel[slot];
+    wq->wheel[slot] = NULL;
+    wq->occupied[0] &= ~(1ULL << slot);
+    while (node != NULL)
+    {
+        lp_workqueue_func_node_t *next = node->next;
+        lp_workqueue_list_add(wq, node, LP_WORKQUEUE_DUE_LIST);
+        node = next;
+    }
+
+    wq->wheel_ms = tick + 1;
+}
+
+/**
+ * @brief Moves the wheel forward until something is due or every tick up to target has been processed
+ * @note Jumps straight between occupied slots, empty stretches cost nothing
+ */
+static void lp_workqueue_wheel_advance(lp_workqueue_t *wq, uint64_t target)
+{
+    while (wq->wheel[LP_WORKQUEUE_DUE_LIST] == NULL)
+    {
+        uint64_t tick;
+        if (!lp_workqueue_wheel_next_tick(wq, &tick) || tick > target)
+        {
+            if (wq->wheel_ms <= target)
+            {
+                wq->wheel_ms = target + 1;
+            }
+            return;
+        }
+        lp_workqueue_wheel_step(wq, tick);
+    }
+}
+
+/**
+ * @brief Pops a node off the pool's free stack
+ * @return NULL if every node is in use
+ */
+static lp_workqueue_func_node_t *lp_workqueue_node_get(lp_workqueue_t *wq)
+{
+    uint64_t head = __atomic_load_n(&wq->pool_head, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t index = (uint32_t)head;
+        if (index == 0)
+        {
+            return NULL;
+        }
+
+        lp_workqueue_func_node_t *node = &wq->pool[index - 1];
+        // Tag goes up on every pop, so a node that was popped and pushed back in between fails the CAS
+        uint64_t next = ((head >> 32) + 1) << 32 | __atomic_load_n(&node->free_next, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&wq->pool_head, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            node->removed = false;
+            node->once = false;
+            node->rearm = false;
+            node->policy = LP_WORKQUEUE_COALESCE;
+            memset(&node->stats, 0, sizeof(node->stats));
+            return node;
+        }
+    }
+}
+
+/**
+ * @brief Pushes a node back onto the pool's free stack
+ */
+static void lp_workqueue_node_release(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    uint32_t index = (uint32_t)(node - wq->pool) + 1;
+    uint64_t head = __atomic_load_n(&wq->pool_head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        __atomic_store_n(&node->free_next, (uint32_t)head, __ATOMIC_RELAXED);
+        uint64_t next = (head & 0xFFFFFFFF00000000ULL) | index;
+        if (__atomic_compare_exchange_n(&wq->pool_head, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Done with a node that was scheduled, caller holds wq_mtx
+ */
+static void lp_workqueue_node_put(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    node->generation++;
+    node->wheel_slot = LP_WORKQUEUE_SLOT_FREE;
+    wq->count--;
+    lp_workqueue_node_release(wq, node);
+}
+
+/**
+ * @brief Works out how late the run that just finished started, caller holds wq_mtx
+ */
+static void lp_workqueue_record_run(lp_workqueue_func_node_t *node)
+{
+    lp_workqueue_stats_t *stats = &node->stats;
+    uint32_t lateness_ms = node->start_ms > node->next_ms ? (uint32_t)(node->start_ms - node->next_ms) : 0;
+
+    if (stats->runs > 0)
+    {
+        uint32_t jitter_ms = lateness_ms > stats->lateness_last_ms ? lateness_ms - stats->lateness_last_ms : stats->lateness_last_ms - lateness_ms;
+        stats->jitter_total_ms += jitter_ms;
+        if (jitter_ms > stats->jitter_max_ms)
+        {
+            stats->jitter_max_ms = jitter_ms;
+        }
+    }
+
+    stats->runs++;
+    stats->lateness_last_ms = lateness_ms;
+    stats->lateness_total_ms += lateness_ms;
+    if (lateness_ms > stats->lateness_max_ms)
+    {
+        stats->lateness_max_ms = lateness_ms;
+    }
+}
+
+/**
+ * @brief Moves a periodic item to it's next deadline on the original schedule, caller holds wq_mtx
+ */
+static void lp_workqueue_next_period(lp_workqueue_func_node_t *node)
+{
+    uint64_t now_ms = get_current_time_millis();
+    if (node->interval_ms == 0)
+    {
+        // Nothing to anchor to, just run every pass
+        node->next_ms = now_ms;
+        return;
+    }
+
+    uint64_t next_ms = node->next_ms + node->interval_ms;
+    if (next_ms < now_ms)
+    {
+        // Deadlines that are already due, next_ms included
+        uint64_t behind = (now_ms - 1 - next_ms) / node->interval_ms + 1;
+        if (node->policy != LP_WORKQUEUE_CATCH_UP)
+        {
+            next_ms += behind * node->interval_ms;
+            node->stats.missed += (uint32_t)behind;
+        }
+    }
+    node->next_ms = next_ms;
+}
+
+/**
+ * @brief Done with a busy item, caller holds wq_mtx. Puts it back on the wheel unless it's finished
+ */
+static void lp_workqueue_finish(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    if (node->removed)
+    {
+        lp_workqueue_node_put(wq, node);
+        return;
+    }
+
+    lp_workqueue_record_run(node);
+    if (node->rearm)
+    {
+        // Rescheduled from inside the callback
+        node->rearm = false;
+        node->next_ms = node->rearm_ms;
+        lp_workqueue_wheel_insert(wq, node);
+    }
+    else if (node->once)
+    {
+        lp_workqueue_node_put(wq, node);
+    }
+    else
+    {
+        lp_workqueue_next_period(node);
+        lp_workqueue_wheel_insert(wq, node);
+    }
+}
+
+/**
+ * @brief Takes a node off the schedule, caller holds wq_mtx
+ */
+static int lp_workqueue_unschedule(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    if (node->wheel_slot == LP_WORKQUEUE_SLOT_BUSY)
+    {
+        // Queued on a worker or running, possibly removing itself from it's own callback. Freed once it's done,
+        // removing it again before then changes nothing
+        node->removed = true;
+        return OS_RET_OK;
+    }
+
+    if (node->wheel_slot >= 0)
+    {
+        lp_workqueue_list_unlink(wq, node);
+        lp_workqueue_node_put(wq, node);
+        return OS_RET_OK;
+    }
+
+    return OS_RET_INVALID_PARAM;
+}
+
+/**
+ * @brief Whether a handle still refers to a scheduled item, caller holds wq_mtx
+ */
+static bool lp_workqueue_handle_valid(lp_workqueue_handle_t *handle)
+{
+    return handle->node != NULL && handle->node->generation == handle->generation &&
+           handle->node->wheel_slot != LP_WORKQUEUE_SLOT_FREE && !handle->node->removed;
+}
+
+/**
+ * @brief Shared by everything that puts a new item on the wheel
+ */
+static int lp_workqueue_schedule(lp_workqueue_t *wq, wq_func func, void *param, uint64_t interval_ms, uint64_t next_ms, bool once,
+                                 lp_workqueue_func_node_t **ptr_node, lp_workqueue_handle_t *handle)
+{
+    if (wq == NULL || func == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    // Filled in before we take the lock, the wheel only sees it once it's ready
+    lp_workqueue_func_node_t *node = lp_workqueue_node_get(wq);
+    if (node == NULL)
+    {
+        return OS_RET_NO_MORE_RESOURCES;
+    }
+
+    node->interval_ms = interval_ms;
+    node->next_ms = next_ms;
+    node->func = func;
+    node->param = param;
+    node->once = once;
+
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        lp_workqueue_node_release(wq, node);
+        return ret;
+    }
+
+    lp_workqueue_wheel_insert(wq, node);
+    wq->count++;
+
+    if (ptr_node != NULL)
+    {
+        *ptr_node = node;
+    }
+    if (handle != NULL)
+    {
+        handle->node = node;
+        handle->generation = node->generation;
+    }
+
+    return os_mut_exit(&wq->wq_mtx);
+}
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+/**
+ * @brief Hands a due item to the next worker, caller holds wq_mtx
+ */
+static void lp_workqueue_dispatch(lp_workqueue_t *wq, lp_workqueue_func_node_t *node)
+{
+    int target = wq->next_worker;
+    wq->next_worker = (wq->next_worker + 1) % LP_WORKQUEUE_NUM_WORKERS;
+
+    lp_workqueue_worker_t *worker = &wq->workers[target];
+    os_mut_entry_wait_indefinite(&worker->worker_mtx);
+    worker->items[(worker->head + worker->len) % wq->num_elements] = node;
+    worker->len++;
+    os_mut_exit(&worker->worker_mtx);
+    os_setbits_signal(&worker->work_signal, 1);
+
+    if (!__atomic_load_n(&worker->busy, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    // Stuck in a long callback, wake someone idle to steal it
+    for (int n = 1; n < LP_WORKQUEUE_NUM_WORKERS; n++)
+    {
+        lp_workqueue_worker_t *thief = &wq->workers[(target + n) % LP_WORKQUEUE_NUM_WORKERS];
+        if (!__atomic_load_n(&thief->busy, __ATOMIC_RELAXED))
+        {
+            os_setbits_signal(&thief->work_signal, 1);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Takes from the front of our own queue, or the back of someone else's
+ * @note The owner runs it's items oldest first rather than the usual work stealing LIFO. Items get queued in
+ * deadline order, so FIFO keeps the most overdue one from waiting behind ones that just became due
+ */
+static lp_workqueue_func_node_t *lp_workqueue_take(lp_workqueue_t *wq, int worker)
+{
+    lp_workqueue_func_node_t *node = NULL;
+    lp_workqueue_worker_t *own = &wq->workers[worker];
+
+    os_mut_entry_wait_indefinite(&own->worker_mtx);
+    if (own->len > 0)
+    {
+        node = own->items[own->head];
+        own->head = (own->head + 1) % wq->num_elements;
+        own->len--;
+    }
+    os_mut_exit(&own->worker_mtx);
+
+    for (int n = 1; node == NULL && n < LP_WORKQUEUE_NUM_WORKERS; n++)
+    {
+        lp_workqueue_worker_t *victim = &wq->workers[(worker + n) % LP_WORKQUEUE_NUM_WORKERS];
+        os_mut_entry_wait_indefinite(&victim->worker_mtx);
+        if (victim->len > 0)
+        {
+            victim->len--;
+            node = victim->items[(victim->head + victim->len) % wq->num_elements];
+        }
+        os_mut_exit(&victim->worker_mtx);
+    }
+    return node;
+}
+
+int _lp_workqueue_worker(lp_workqueue_t *wq, int worker)
+{
+    if (wq == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (worker < 0 || worker >= LP_WORKQUEUE_NUM_WORKERS)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    lp_workqueue_worker_t *own = &wq->workers[worker];
+    for (;;)
+    {
+        lp_workqueue_func_node_t *node = lp_workqueue_take(wq, worker);
+        if (node == NULL)
+        {
+            // Clear first then look again, so a dispatch in between still wakes us
+            os_clearbits(&own->work_signal, 1);
+            node = lp_workqueue_take(wq, worker);
+            if (node == NULL)
+            {
+                int ret = os_waitbits_indefinite(&own->work_signal, 1);
+                if (ret != OS_RET_OK)
+                {
+                    return ret;
+                }
+                continue;
+            }
+        }
+
+        // start_ms is read by finish and get_stats under wq_mtx, so it gets written under it too
+        os_mut_entry_wait_indefinite(&wq->wq_mtx);
+        bool removed = node->removed;
+        node->start_ms = get_current_time_millis();
+        os_mut_exit(&wq->wq_mtx);
+
+        if (!removed)
+        {
+            __atomic_store_n(&own->busy, 1, __ATOMIC_RELAXED);
+            node->func(node->param);
+            __atomic_store_n(&own->busy, 0, __ATOMIC_RELAXED);
+        }
+
+        os_mut_entry_wait_indefinite(&wq->wq_mtx);
+        lp_workqueue_finish(wq, node);
+        os_mut_exit(&wq->wq_mtx);
+    }
+}
+#endif
+
+/**
+ * @brief Undoes a half finished _init_lp_workqueue, everything up to and including wake_signal got set up
+ * @param int num_workers how many workers were fully set up
+ */
+static int lp_workqueue_init_fail(lp_workqueue_t *wq, int num_workers, int ret)
+{
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+    for (int n = 0; n < num_workers; n++)
+    {
+        free(wq->workers[n].items);
+        wq->workers[n].items = NULL;
+        os_mut_deinit(&wq->workers[n].worker_mtx);
+        os_setbits_deconstruct(&wq->workers[n].work_signal);
+    }
+#endif
+
+    os_setbits_deconstruct(&wq->wake_signal);
+    free(wq->pool);
+    wq->pool = NULL;
+    return ret;
+}
+
 int _init_lp_workqueue(lp_workqueue_t *wq, int max_elements_inqueue)
 {
     if (wq == NULL)
@@ -15,100 +558,262 @@ int _init_lp_workqueue(lp_workqueue_t *wq, int max_elements_inqueue)
         return OS_RET_NULL_PTR;
     }
 
-    wq->shortest_interval_ms = INT64_MAX;
-    wq->num_elements = max_elements_inqueue;
-    return os_mut_init(&wq->wq_mtx);
+    if (max_elements_inqueue <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    for (int n = 0; n <= LP_WORKQUEUE_DUE_LIST; n++)
+    {
+        wq->wheel[n] = NULL;
+    }
+    for (int n = 0; n < LP_WORKQUEUE_WHEEL_LEVELS; n++)
+    {
+        wq->occupied[n] = 0;
+    }
+    wq->wheel_ms = get_current_time_millis();
+    wq->count = 0;
+
+    wq->pool = (lp_workqueue_func_node_t *)malloc(sizeof(lp_workqueue_func_node_t) * max_elements_inqueue);
+    if (wq->pool == NULL)
+    {
+        return OS_RET_LOW_MEM_ERROR;
+    }
+    // Chain every node onto the free stack, lowest index on top
+    for (int n = 0; n < max_elements_inqueue; n++)
+    {
+        wq->pool[n].generation = 0;
+        wq->pool[n].wheel_slot = LP_WORKQUEUE_SLOT_FREE;
+        wq->pool[n].free_next = n + 1 < max_elements_inqueue ? (uint32_t)(n + 2) : 0;
+    }
+    wq->pool_head = 1;
+
+    wq->num_elements = max_elements_inqueue;
+
+    wq->wake_ms = 0;
+    int ret = os_setbits_init(&wq->wake_signal);
+    if (ret != OS_RET_OK)
+    {
+        free(wq->pool);
+        wq->pool = NULL;
+        return ret;
+    }
+    os_clearbits(&wq->wake_signal, 1);
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+    wq->next_worker = 0;
+    for (int n = 0; n < LP_WORKQUEUE_NUM_WORKERS; n++)
+    {
+        lp_workqueue_worker_t *worker = &wq->workers[n];
+        // Any one worker could end up holding every item
+        worker->items = (lp_workqueue_func_node_t **)malloc(sizeof(lp_workqueue_func_node_t *) * max_elements_inqueue);
+        if (worker->items == NULL)
+        {
+            return lp_workqueue_init_fail(wq, n, OS_RET_LOW_MEM_ERROR);
+        }
+        worker->head = 0;
+        worker->len = 0;
+        worker->busy = 0;
+
+        ret = os_mut_init(&worker->worker_mtx);
+        if (ret != OS_RET_OK)
+        {
+            free(worker->items);
+            worker->items = NULL;
+            return lp_workqueue_init_fail(wq, n, ret);
+        }
+        ret = os_setbits_init(&worker->work_signal);
+        if (ret != OS_RET_OK)
+        {
+            free(worker->items);
+            worker->items = NULL;
+            os_mut_deinit(&worker->worker_mtx);
+            return lp_workqueue_init_fail(wq, n, ret);
+        }
+        os_clearbits(&worker->work_signal, 1);
+    }
+#endif
+
+    ret = os_mut_init(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        return lp_workqueue_init_fail(wq, LP_WORKQUEUE_NUM_WORKERS, ret);
+    }
+    return OS_RET_OK;
+}
+
+int _deinit_lp_workqueue(lp_workqueue_t *wq)
+{
+    if (wq == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (wq->pool == NULL)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+    for (int n = 0; n < LP_WORKQUEUE_NUM_WORKERS; n++)
+    {
+        free(wq->workers[n].items);
+        wq->workers[n].items = NULL;
+        os_mut_deinit(&wq->workers[n].worker_mtx);
+        os_setbits_deconstruct(&wq->workers[n].work_signal);
+    }
+#endif
+
+    free(wq->pool);
+    wq->pool = NULL;
+    os_setbits_deconstruct(&wq->wake_signal);
+    return os_mut_deinit(&wq->wq_mtx);
 }
 
 int _lp_workqueue_add_func(lp_workqueue_t *wq, wq_func func, void *param, int interval_ms, lp_workqueue_func_node_t **ptr_node)
 {
+    // Due straight away, and every period after is anchored to now
+    return lp_workqueue_schedule(wq, func, param, interval_ms, get_current_time_millis(), false, ptr_node, NULL);
+}
 
-    if (wq == NULL)
+int _lp_workqueue_set_policy(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node, lp_workqueue_policy_t policy)
+{
+    if (wq == NULL || ptr_node == NULL)
     {
         return OS_RET_NULL_PTR;
     }
-    lp_workqueue_func_node_t *node;
 
-    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (policy < LP_WORKQUEUE_COALESCE || policy > LP_WORKQUEUE_SKIP)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
 
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
     if (ret != OS_RET_OK)
     {
         return ret;
     }
 
-    if (wq->head == NULL)
+    if (ptr_node->wheel_slot == LP_WORKQUEUE_SLOT_FREE)
     {
-        wq->head = (lp_workqueue_func_node_t *)malloc(sizeof(lp_workqueue_func_node_t));
-        node = wq->head;
+        ret = OS_RET_INVALID_PARAM;
     }
     else
     {
+        ptr_node->policy = policy;
+    }
 
-        node = wq->head;
-        while (node->next != NULL)
-        {
-            node = node->next;
-        }
+    os_mut_exit(&wq->wq_mtx);
+    return ret;
+}
 
-        node->next = (lp_workqueue_func_node_t *)malloc(sizeof(lp_workqueue_func_node_t));
-        node = node->next;
+int _lp_workqueue_get_stats(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node, lp_workqueue_stats_t *stats)
+{
+    if (wq == NULL || ptr_node == NULL || stats == NULL)
+    {
+        return OS_RET_NULL_PTR;
     }
 
-    if (node == NULL)
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
     {
-        os_mut_exit(&wq->wq_mtx);
-        return OS_RET_NO_MORE_RESOURCES;
+        return ret;
     }
 
-    node->interval_ms = interval_ms;
-    node->next_ms = 0;
-    node->func = func;
-    node->param = param;
-    node->next = NULL;
+    if (ptr_node->wheel_slot == LP_WORKQUEUE_SLOT_FREE)
+    {
+        ret = OS_RET_INVALID_PARAM;
+    }
+    else
+    {
+        *stats = ptr_node->stats;
+    }
 
-    if (ptr_node != NULL)
+    os_mut_exit(&wq->wq_mtx);
+    return ret;
+}
+
+int _lp_workqueue_rm(lp_workqueue *wq, lp_workqueue_func_node_t *ptr_node)
+{
+    if (wq == NULL || ptr_node == NULL)
     {
-        *ptr_node = node;
+        return OS_RET_NULL_PTR;
+    }
+
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
     }
 
-    if (wq->shortest_interval_ms > interval_ms)
+    ret = lp_workqueue_unschedule(wq, ptr_node);
+    os_mut_exit(&wq->wq_mtx);
+    return ret;
+}
+
+int _lp_workqueue_schedule_at(lp_workqueue_t *wq, wq_func func, void *param, uint64_t at_ms, lp_workqueue_handle_t *handle)
+{
+    return lp_workqueue_schedule(wq, func, param, 0, at_ms, true, NULL, handle);
+}
+
+int _lp_workqueue_schedule_once(lp_workqueue_t *wq, wq_func func, void *param, uint32_t delay_ms, lp_workqueue_handle_t *handle)
+{
+    return _lp_workqueue_schedule_at(wq, func, param, get_current_time_millis() + delay_ms, handle);
+}
+
+int _lp_workqueue_cancel(lp_workqueue_t *wq, lp_workqueue_handle_t *handle)
+{
+    if (wq == NULL || handle == NULL)
     {
-        wq->shortest_interval_ms = interval_ms;
+        return OS_RET_NULL_PTR;
     }
 
-    ret = os_mut_exit(&wq->wq_mtx);
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
 
+    ret = lp_workqueue_handle_valid(handle) ? lp_workqueue_unschedule(wq, handle->node) : OS_RET_INVALID_PARAM;
+    os_mut_exit(&wq->wq_mtx);
     return ret;
 }
 
-int _lp_workqueue_rm(lp_workqueue *wq, lp_workqueue_func_node_t *ptr_node)
+int _lp_workqueue_reschedule(lp_workqueue_t *wq, lp_workqueue_handle_t *handle, uint32_t delay_ms)
 {
+    if (wq == NULL || handle == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
 
     int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
     if (ret != OS_RET_OK)
     {
         return ret;
     }
-    lp_workqueue_func_node_t *node = wq->head;
-    if (node == NULL)
+
+    if (!lp_workqueue_handle_valid(handle))
     {
-        goto wq_rm_end;
+        os_mut_exit(&wq->wq_mtx);
+        return OS_RET_INVALID_PARAM;
     }
 
-    while (node->next != NULL)
+    lp_workqueue_func_node_t *node = handle->node;
+    uint64_t next_ms = get_current_time_millis() + delay_ms;
+    if (node->wheel_slot >= 0)
     {
-        // Delete then move on
-        if (node->next == ptr_node)
-        {
-            lp_workqueue_func_node_t *del_node = node->next;
-            node->next = node->next->next;
-            free(del_node);
-        }
+        node->next_ms = next_ms;
+        lp_workqueue_list_unlink(wq, node);
+        lp_workqueue_wheel_insert(wq, node);
+    }
+    else
+    {
+        // Busy, goes back on the wheel with this deadline once it's done
+        node->rearm = true;
+        node->rearm_ms = next_ms;
     }
 
-wq_rm_end:
-    ret = os_mut_exit(&wq->wq_mtx);
-    return ret;
+    return os_mut_exit(&wq->wq_mtx);
 }
 
 int _lp_workqueue_loop(lp_workqueue_t *wq)
@@ -119,78 +824,331 @@ int _lp_workqueue_loop(lp_workqueue_t *wq)
     }
 
     int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
-    lp_workqueue_func_node_t *node = wq->head;
-    ret |= os_mut_exit(&wq->wq_mtx);
-
-    if (node == NULL)
-        return OS_RET_OK;
-
     if (ret != OS_RET_OK)
     {
         return ret;
     }
 
-    while (true)
+    // Due means strictly past next_ms. Anything rescheduled during this pass lands after target, so we can't spin on it
+    uint64_t now_ms = get_current_time_millis();
+    uint64_t target = now_ms > 0 ? now_ms - 1 : 0;
+    for (;;)
     {
+        lp_workqueue_wheel_advance(wq, target);
+        lp_workqueue_func_node_t *node = wq->wheel[LP_WORKQUEUE_DUE_LIST];
+        if (node == NULL)
+        {
+            break;
+        }
+
+        lp_workqueue_list_unlink(wq, node);
+
+        if (node->policy == LP_WORKQUEUE_SKIP && !node->once && node->interval_ms > 0 &&
+            get_current_time_millis() - node->next_ms > node->interval_ms)
+        {
+            // A whole period late, drop this run too
+            node->stats.missed++;
+            lp_workqueue_next_period(node);
+            lp_workqueue_wheel_insert(wq, node);
+            continue;
+        }
+
+        node->wheel_slot = LP_WORKQUEUE_SLOT_BUSY;
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+        lp_workqueue_dispatch(wq, node);
+#else
+        node->start_ms = get_current_time_millis();
+        os_mut_exit(&wq->wq_mtx);
+
+        // run cb
+        node->func(node->param);
 
-        // Fill in parameters in threadsafe way
         os_mut_entry_wait_indefinite(&wq->wq_mtx);
-        uint64_t next_ms = node->next_ms;
-        wq_func func = node->func;
-        void *param = node->param;
+        lp_workqueue_finish(wq, node);
+#endif
+    }
+
+    return os_mut_exit(&wq->wq_mtx);
+}
+
+int _lp_workqueue_wait(lp_workqueue_t *wq)
+{
+    if (wq == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
+
+    uint64_t next_ms;
+    bool pending = lp_workqueue_wheel_next_tick(wq, &next_ms);
+    if (wq->wheel[LP_WORKQUEUE_DUE_LIST] != NULL)
+    {
         os_mut_exit(&wq->wq_mtx);
+        return OS_RET_OK;
+    }
 
-        // If we are ready to run next command
-        if (next_ms < get_current_time_millis())
+    uint64_t timeout_ms = 0;
+    if (pending)
+    {
+        // Due means strictly past next_ms
+        uint64_t now_ms = get_current_time_millis();
+        if (next_ms < now_ms)
         {
-            // run cb
-            func(param);
-
-            // Update the next entry in threadsafe way
-            os_mut_entry_wait_indefinite(&wq->wq_mtx);
-            node->next_ms = get_current_time_millis() + node->interval_ms;
             os_mut_exit(&wq->wq_mtx);
+            return OS_RET_OK;
+        }
+        timeout_ms = next_ms - now_ms + 1;
+        if (timeout_ms > UINT32_MAX)
+        {
+            timeout_ms = UINT32_MAX;
         }
+    }
 
-        // Migrate to next node
-        os_mut_entry_wait_indefinite(&wq->wq_mtx);
-        node = node->next;
-        os_mut_exit(&wq->wq_mtx);
+    // Cleared under the lock, so an insert that lands before we're actually waiting still gets through
+    wq->wake_ms = pending ? next_ms : UINT64_MAX;
+    os_clearbits(&wq->wake_signal, 1);
+    os_mut_exit(&wq->wq_mtx);
 
-        if (node == NULL)
-            break;
+    if (pending)
+    {
+        ret = os_waitbits(&wq->wake_signal, 1, (uint32_t)timeout_ms);
+    }
+    else
+    {
+        ret = os_waitbits_indefinite(&wq->wake_signal, 1);
     }
 
-    return OS_RET_OK;
+    os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    wq->wake_ms = 0;
+    os_mut_exit(&wq->wq_mtx);
+    return ret == OS_RET_TIMEOUT ? OS_RET_OK : ret;
+}
+
+int _lp_workqueue_next_ms(lp_workqueue_t *wq, uint64_t *next_ms)
+{
+    if (wq == NULL || next_ms == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    int ret = os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
+
+    if (wq->wheel[LP_WORKQUEUE_DUE_LIST] != NULL)
+    {
+        *next_ms = wq->wheel_ms - 1;
+    }
+    else if (!lp_workqueue_wheel_next_tick(wq, next_ms))
+    {
+        ret = OS_RET_LIST_EMPTY;
+    }
+
+    os_mut_exit(&wq->wq_mtx);
+    return ret;
 }
 
 static lp_workqueue_t mod_level_lpworkqueue;
+// Only set once _init_lp_workqueue went through, nothing touches the module level workqueue before that
+static bool mod_level_inited = false;
 
 void lp_workqueue_init(void *parameters)
 {
-    _init_lp_workqueue(&mod_level_lpworkqueue, 64);
+    if (mod_level_inited)
+    {
+        return;
+    }
+    mod_level_inited = _init_lp_workqueue(&mod_level_lpworkqueue, LP_WORKQUEUE_MAX_ITEMS) == OS_RET_OK;
 }
 
 void lp_workqueue_thread(void *parameters)
 {
+    if (mod_level_inited == false)
+    {
+        return;
+    }
+
     for (;;)
     {
-        int sleep_interval_ms = mod_level_lpworkqueue.shortest_interval_ms;
         _lp_workqueue_loop(&mod_level_lpworkqueue);
-        os_thread_sleep_ms(sleep_interval_ms);
+        _lp_workqueue_wait(&mod_level_lpworkqueue);
+    }
+}
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+void lp_workqueue_worker_thread(void *parameters)
+{
+    if (mod_level_inited == false)
+    {
+        return;
     }
+    _lp_workqueue_worker(&mod_level_lpworkqueue, (int)(intptr_t)parameters);
 }
+#endif
 
 int lp_workqueue_add_func(wq_func func, void *param, int interval_ms, lp_workqueue_func_node_t **ptr_node)
 {
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
     return _lp_workqueue_add_func(&mod_level_lpworkqueue, func, param, interval_ms, ptr_node);
 }
 
 int lp_workqueue_rm(lp_workqueue_func_node_t *ptr_node)
 {
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
     return _lp_workqueue_rm(&mod_level_lpworkqueue, ptr_node);
 }
 
+int lp_workqueue_set_policy(lp_workqueue_func_node_t *ptr_node, lp_workqueue_policy_t policy)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_set_policy(&mod_level_lpworkqueue, ptr_node, policy);
+}
+
+int lp_workqueue_get_stats(lp_workqueue_func_node_t *ptr_node, lp_workqueue_stats_t *stats)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_get_stats(&mod_level_lpworkqueue, ptr_node, stats);
+}
+
+int lp_workqueue_schedule_once(wq_func func, void *param, uint32_t delay_ms, lp_workqueue_handle_t *handle)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_schedule_once(&mod_level_lpworkqueue, func, param, delay_ms, handle);
+}
+
+int lp_workqueue_schedule_at(wq_func func, void *param, uint64_t at_ms, lp_workqueue_handle_t *handle)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_schedule_at(&mod_level_lpworkqueue, func, param, at_ms, handle);
+}
+
+int lp_workqueue_cancel(lp_workqueue_handle_t *handle)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_cancel(&mod_level_lpworkqueue, handle);
+}
+
+int lp_workqueue_reschedule(lp_workqueue_handle_t *handle, uint32_t delay_ms)
+{
+    if (mod_level_inited == false)
+    {
+        return OS_RET_NOT_INITIALIZED;
+    }
+    return _lp_workqueue_reschedule(&mod_level_lpworkqueue, handle, delay_ms);
+}
+
+#ifdef LP_WORKQUEUE_BENCHMARK
+#include <stdio.h>
+
+#define LP_WORKQUEUE_BENCHMARK_RUN_MS 1000
+
+static uint32_t lp_workqueue_bench_runs;
+
+static void lp_workqueue_bench_cb(void *param)
+{
+    lp_workqueue_bench_runs++;
+}
+
+/**
+ * @brief Schedules num_items one shots at staggered deadlines from 1 ms to an hour, lets the wheel run
+ * for a second, then cancels whatever is left
+ * @note The first pass is reported on it's own, the rest show the steady state cost of only touching what's due
+ */
+static void lp_workqueue_bench_items(int num_items)
+{
+    static lp_workqueue_t wq;
+    lp_workqueue_handle_t *handles = (lp_workqueue_handle_t *)malloc(sizeof(lp_workqueue_handle_t) * num_items);
+    if (handles == NULL || _init_lp_workqueue(&wq, num_items) != OS_RET_OK)
+    {
+        free(handles);
+        return;
+    }
+
+    // One in ten items falls due while we run, the rest are spread out to an hour
+    uint32_t lcg = 12345;
+    uint64_t start_ms = get_current_time_millis();
+    for (int n = 0; n < num_items; n++)
+    {
+        lcg = lcg * 1103515245 + 12345;
+        uint64_t offset_ms = (n % 10 == 0) ? 1 + (lcg % LP_WORKQUEUE_BENCHMARK_RUN_MS) : LP_WORKQUEUE_BENCHMARK_RUN_MS + (lcg % 3600000);
+        _lp_workqueue_schedule_at(&wq, lp_workqueue_bench_cb, NULL, start_ms + offset_ms, &handles[n]);
+    }
+    uint64_t add_ms = get_current_time_millis() - start_ms;
+
+    lp_workqueue_bench_runs = 0;
+    uint64_t pass_ms = get_current_time_millis();
+    _lp_workqueue_loop(&wq);
+    uint64_t first_ms = get_current_time_millis() - pass_ms;
+    uint32_t first_runs = lp_workqueue_bench_runs;
+
+    uint64_t loop_ms = 0;
+    uint64_t loop_max_ms = 0;
+    uint32_t passes = 0;
+    uint64_t run_start_ms = get_current_time_millis();
+    while (get_current_time_millis() - run_start_ms < LP_WORKQUEUE_BENCHMARK_RUN_MS)
+    {
+        os_thread_sleep_ms(1);
+        pass_ms = get_current_time_millis();
+        _lp_workqueue_loop(&wq);
+        pass_ms = get_current_time_millis() - pass_ms;
+        loop_ms += pass_ms;
+        loop_max_ms = pass_ms > loop_max_ms ? pass_ms : loop_max_ms;
+        passes++;
+    }
+
+    start_ms = get_current_time_millis();
+    for (int n = 0; n < num_items; n++)
+    {
+        _lp_workqueue_cancel(&wq, &handles[n]);
+    }
+    uint64_t cancel_ms = get_current_time_millis() - start_ms;
+
+    char line[192];
+    snprintf(line, sizeof(line), "%7d items: schedule %llu ms, first pass %llu ms (%lu run), %lu run over %lu passes in %llu ms (max %llu ms), cancel %llu ms",
+             num_items, (unsigned long long)add_ms, (unsigned long long)first_ms, (unsigned long)first_runs, (unsigned long)(lp_workqueue_bench_runs - first_runs),
+             (unsigned long)passes, (unsigned long long)loop_ms, (unsigned long long)loop_max_ms, (unsigned long long)cancel_ms);
+    os_println(line);
+
+    _deinit_lp_workqueue(&wq);
+    free(handles);
+}
+
+void lp_workqueue_benchmark(void)
+{
+    lp_workqueue_bench_items(10000);
+    lp_workqueue_bench_items(100000);
+}
+#endif
+
 #ifdef LP_WORKQUEUE_TESTS
 
 lp_workqueue_t test_wq;
@@ -198,40 +1156,157 @@ void lowprio_thread(void *params)
 {
     for (;;)
     {
-        lp_workqueue_loop(&test_wq);
-        os_thread_sleep_ms(1);
+        _lp_workqueue_loop(&test_wq);
+        _lp_workqueue_wait(&test_wq);
     }
 }
 
 void loprio_1s_cb(void *params)
 {
-    println("1 second callback");
+    os_println((char *)"1 second callback");
 }
 
 void loprio_5s_cb(void *params)
 {
-    println("5 second callback");
+    os_println((char *)"5 second callback");
 }
 
 void loprio_10s_cb(void *params)
 {
-    println("10 second callback");
+    os_println((char *)"10 second callback");
 }
 
 void loprio_100ms_cb(void *params)
 {
-    println("100 millisecond callback");
+    os_println((char *)"100 millisecond callback");
 }
 
 void test_lprio(void)
 {
-    init_lp_workqueue(&test_wq, 40);
-    lp_workqueue_add_func(&test_wq, loprio_1s_cb, NULL, 1000, NULL);
-    lp_workqueue_add_func(&test_wq, loprio_5s_cb, NULL, 5000, NULL);
-    lp_workqueue_add_func(&test_wq, loprio_10s_cb, NULL, 10000, NULL);
-    lp_workqueue_add_func(&test_wq, loprio_100ms_cb, NULL, 100, NULL);
+    _init_lp_workqueue(&test_wq, 40);
+    _lp_workqueue_add_func(&test_wq, loprio_1s_cb, NULL, 1000, NULL);
+    _lp_workqueue_add_func(&test_wq, loprio_5s_cb, NULL, 5000, NULL);
+    _lp_workqueue_add_func(&test_wq, loprio_10s_cb, NULL, 10000, NULL);
+    _lp_workqueue_add_func(&test_wq, loprio_100ms_cb, NULL, 100, NULL);
 
     os_add_thread(lowprio_thread, NULL, 8192, NULL);
 }
 #endif
+#ifdef UNIT_CHECK_MODULE
+static lp_workqueue_t unit_wq;
+
+static void lp_workqueue_unit_cb(void *param)
+{
+    (*(int *)param)++;
+}
+
+/**
+ * @brief Moves the wheel up to target by hand, takes whatever came due off the due list and frees it
+ * @return the node that came due, NULL if nothing did
+ */
+static lp_workqueue_func_node_t *lp_workqueue_unit_expire(lp_workqueue_t *wq, uint64_t target)
+{
+    os_mut_entry_wait_indefinite(&wq->wq_mtx);
+    lp_workqueue_wheel_advance(wq, target);
+    lp_workqueue_func_node_t *node = wq->wheel[LP_WORKQUEUE_DUE_LIST];
+    if (node != NULL)
+    {
+        lp_workqueue_list_unlink(wq, node);
+        lp_workqueue_node_put(wq, node);
+    }
+    os_mut_exit(&wq->wq_mtx);
+    return node;
+}
+
+int lp_workqueue_unit_test(void)
+{
+    unit_test_mod_init();
+
+    int ret = _init_lp_workqueue(&unit_wq, 16);
+    assert_testcase_equal("Workqueue init", ret, OS_RET_OK);
+
+    // The wheel is driven by hand from a top level boundary, so every offset below lands right on, or next to, a slot edge
+    const uint64_t base = 3ULL << (LP_WORKQUEUE_WHEEL_BITS * LP_WORKQUEUE_WHEEL_LEVELS);
+    const uint64_t offsets[] = {1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145, 20000000};
+    const int num_offsets = sizeof(offsets) / sizeof(offsets[0]);
+    lp_workqueue_handle_t handles[sizeof(offsets) / sizeof(offsets[0])];
+    int runs = 0;
+
+    unit_wq.wheel_ms = base;
+    for (int n = 0; n < num_offsets; n++)
+    {
+        ret = _lp_workqueue_schedule_at(&unit_wq, lp_workqueue_unit_cb, &runs, base + offsets[n], &handles[n]);
+        assert_testcase_equal("schedule at", ret, OS_RET_OK);
+    }
+
+    // Each one has to come out exactly on it's deadline, whichever levels it cascaded down through
+    for (int n = 0; n < num_offsets; n++)
+    {
+        assert_testcase_null("not due a tick early", lp_workqueue_unit_expire(&unit_wq, base + offsets[n] - 1));
+        assert_testcase_equal("due on the deadline", lp_workqueue_unit_expire(&unit_wq, base + offsets[n]) == handles[n].node, true);
+    }
+    assert_testcase_equal("wheel empty after cascade", unit_wq.count, 0);
+    assert_testcase_equal("handle stale once expired", _lp_workqueue_cancel(&unit_wq, &handles[0]), OS_RET_INVALID_PARAM);
+
+    ret = _deinit_lp_workqueue(&unit_wq);
+    assert_testcase_equal("Workqueue deinit", ret, OS_RET_OK);
+
+    // Back on the real clock. A 10 ms item that's 35 ms behind, what each policy does with the periods it missed
+    ret = _init_lp_workqueue(&unit_wq, 16);
+    assert_testcase_equal("Workqueue init", ret, OS_RET_OK);
+    lp_workqueue_func_node_t *periodic = NULL;
+    ret = _lp_workqueue_add_func(&unit_wq, lp_workqueue_unit_cb, &runs, 10, &periodic);
+    assert_testcase_equal("add periodic", ret, OS_RET_OK);
+
+    os_mut_entry_wait_indefinite(&unit_wq.wq_mtx);
+    uint64_t now_ms = get_current_time_millis();
+    periodic->policy = LP_WORKQUEUE_CATCH_UP;
+    periodic->next_ms = now_ms - 35;
+    lp_workqueue_next_period(periodic);
+    uint64_t catch_up_ms = periodic->next_ms;
+    uint32_t catch_up_missed = periodic->stats.missed;
+
+    periodic->policy = LP_WORKQUEUE_COALESCE;
+    periodic->next_ms = now_ms - 35;
+    lp_workqueue_next_period(periodic);
+    uint64_t coalesce_ms = periodic->next_ms;
+    uint32_t coalesce_missed = periodic->stats.missed;
+    os_mut_exit(&unit_wq.wq_mtx);
+
+    assert_testcase_equal("catch up runs the next missed period", catch_up_ms == now_ms - 25, true);
+    assert_testcase_equal("catch up misses nothing", catch_up_missed, 0);
+    assert_testcase_equal("coalesce stays on the original schedule", (coalesce_ms - (now_ms - 35)) % 10, 0);
+    assert_testcase_in_range("coalesce moves past now", (int)(coalesce_ms - now_ms), 20, 0);
+    assert_testcase_in_range("coalesce counts the periods it folded", (int)coalesce_missed, 5, 3);
+    _lp_workqueue_rm(&unit_wq, periodic);
+
+    // Skip drops a run that would start a whole period late without calling it
+    ret = _lp_workqueue_add_func(&unit_wq, lp_workqueue_unit_cb, &runs, 10, &periodic);
+    assert_testcase_equal("add periodic", ret, OS_RET_OK);
+    _lp_workqueue_set_policy(&unit_wq, periodic, LP_WORKQUEUE_SKIP);
+    os_mut_entry_wait_indefinite(&unit_wq.wq_mtx);
+    lp_workqueue_list_unlink(&unit_wq, periodic);
+    periodic->next_ms = get_current_time_millis() - 25;
+    lp_workqueue_wheel_insert(&unit_wq, periodic);
+    os_mut_exit(&unit_wq.wq_mtx);
+
+    // Due means strictly past, so let the clock move on first
+    os_thread_sleep_ms(2);
+    runs = 0;
+    _lp_workqueue_loop(&unit_wq);
+    lp_workqueue_stats_t stats;
+    _lp_workqueue_get_stats(&unit_wq, periodic, &stats);
+    assert_testcase_equal("skip doesn't run late", runs, 0);
+    assert_testcase_equal("skip doesn't count a run", stats.runs, 0);
+    assert_testcase_in_range("skip counts the periods it dropped", (int)stats.missed, 6, 3);
+    assert_testcase_equal("skip waits for the next period", periodic->next_ms > get_current_time_millis() - 1, true);
+    _lp_workqueue_rm(&unit_wq, periodic);
+
+    ret = _deinit_lp_workqueue(&unit_wq);
+    assert_testcase_equal("Workqueue deinit", ret, OS_RET_OK);
+
+    unit_testcase_end();
+    return OS_RET_OK;
+}
+#endif
 #endif
\ No newline at end of file
@@ -11,35 +11,171 @@
  */
 typedef void (*wq_func)(void *param);
 
+/**
+ * @brief Timing wheel shape, LP_WORKQUEUE_WHEEL_LEVELS levels of 64 slots at 1 ms per tick
+ * @note Every level is 64 times coarser than the one below, so 4 levels reach out past 4.6 hours.
+ * Items further out than that park in the top level and get looked at again once per lap
+ */
+#ifndef LP_WORKQUEUE_WHEEL_LEVELS
+#define LP_WORKQUEUE_WHEEL_LEVELS 4
+#endif
+#define LP_WORKQUEUE_WHEEL_BITS 6
+#define LP_WORKQUEUE_WHEEL_SLOTS (1 << LP_WORKQUEUE_WHEEL_BITS)
+// One more list past the wheel for items that are due and waiting to run
+#define LP_WORKQUEUE_DUE_LIST (LP_WORKQUEUE_WHEEL_LEVELS * LP_WORKQUEUE_WHEEL_SLOTS)
+// Item has been pulled off the wheel and is queued on a worker or running
+#define LP_WORKQUEUE_SLOT_BUSY (-1)
+// Node is sitting on the free list
+#define LP_WORKQUEUE_SLOT_FREE (-2)
+
+/**
+ * @brief Number of worker threads running due items
+ * @note 0 runs every callback inline on whoever calls _lp_workqueue_loop, like it always has.
+ * Otherwise the loop only hands due items out to the workers, run one lp_workqueue_worker_thread per worker
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef LP_WORKQUEUE_NUM_WORKERS
+#define LP_WORKQUEUE_NUM_WORKERS 0
+#endif
+
+/**
+ * @brief How many items the module level workqueue set up by lp_workqueue_init can hold at once
+ * @note Can be overridden in enabled_modules.h
+ */
+#ifndef LP_WORKQUEUE_MAX_ITEMS
+#define LP_WORKQUEUE_MAX_ITEMS 64
+#endif
+
+/**
+ * @brief What a periodic item does about periods it missed because it ran late
+ */
+typedef enum lp_workqueue_policy_t
+{
+    // The late run stands in for every period it missed, then carry on from the next one on the original schedule
+    LP_WORKQUEUE_COALESCE = 0,
+    // Run every missed period back to back until it's caught up
+    LP_WORKQUEUE_CATCH_UP,
+    // Don't run at all once a whole period late, wait for the next one on the original schedule
+    LP_WORKQUEUE_SKIP,
+} lp_workqueue_policy_t;
+
+/**
+ * @brief Timing of a periodic item, lateness is how long after it's deadline a run started
+ * @note Jitter is how much the lateness moved between two runs in a row
+ */
+typedef struct lp_workqueue_stats_t
+{
+    uint32_t runs;
+    // Periods that never got a run of their own
+    uint32_t missed;
+    uint32_t lateness_last_ms;
+    uint32_t lateness_max_ms;
+    uint64_t lateness_total_ms;
+    uint32_t jitter_max_ms;
+    uint64_t jitter_total_ms;
+} lp_workqueue_stats_t;
+
 typedef struct lp_workqueue_func_node
 {
     wq_func func;
     uint64_t interval_ms;
     uint64_t next_ms;
     void *param;
+
+    // Neighbors in whichever wheel slot we sit in
     struct lp_workqueue_func_node *next;
+    struct lp_workqueue_func_node *prev;
+    // Which slot that is, LP_WORKQUEUE_DUE_LIST when due, LP_WORKQUEUE_SLOT_BUSY while queued on a worker or running
+    int wheel_slot;
+    // Removed while busy, whoever finishes with it frees it
+    bool removed;
+    // Runs once then goes away, rather than every interval_ms
+    bool once;
+    // Rescheduled while busy, goes back on the wheel for rearm_ms
+    bool rearm;
+    uint64_t rearm_ms;
+    // Bumped every time the node is freed, so handles to what used to be here go stale
+    uint32_t generation;
+    // Next free node in the pool, index + 1 so 0 can end the list
+    uint32_t free_next;
+
+    lp_workqueue_policy_t policy;
+    // When the callback that's running now started
+    uint64_t start_ms;
+    lp_workqueue_stats_t stats;
 
 } lp_workqueue_func_node_t;
 
+/**
+ * @brief Refers to a scheduled item, stays safe to use after the item has run or been cancelled
+ */
+typedef struct lp_workqueue_handle
+{
+    lp_workqueue_func_node_t *node;
+    uint32_t generation;
+} lp_workqueue_handle_t;
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+/**
+ * @brief Due items waiting on one worker, the worker takes from the front and idle workers steal from the back
+ */
+typedef struct lp_workqueue_worker
+{
+    lp_workqueue_func_node_t **items;
+    int head;
+    int len;
+    os_mut_t worker_mtx;
+    os_setbits_t work_signal;
+    // In the middle of a callback, so anything queued behind it is up for stealing
+    uint32_t busy;
+} lp_workqueue_worker_t;
+#endif
+
 /**
  * @brief Primary low priority work queue
+ * @note Items live in a hierarchical timing wheel, so adding, removing and expiring an item are all O(1)
+ * and a pass only touches what's due
  */
 typedef struct lp_workqueue
 {
-    lp_workqueue_func_node_t *head;
+    lp_workqueue_func_node_t *wheel[LP_WORKQUEUE_DUE_LIST + 1];
+    // Which slots of each level have anything in them
+    uint64_t occupied[LP_WORKQUEUE_WHEEL_LEVELS];
+    // Next tick the wheel hasn't processed yet
+    uint64_t wheel_ms;
+    int count;
+    // Every node we'll ever use, allocated up front, so stale handles never point at freed memory
+    lp_workqueue_func_node_t *pool;
+    // Lock free stack of unused pool nodes, ABA tag in the upper 32 bits and index + 1 in the lower
+    uint64_t pool_head;
+
     os_mut_t wq_mtx;
-    uint64_t shortest_interval_ms;
     int num_elements;
+
+    // Deadline _lp_workqueue_wait is sleeping towards, 0 while nobody is waiting. Anything added earlier signals wake_signal
+    uint64_t wake_ms;
+    os_setbits_t wake_signal;
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+    lp_workqueue_worker_t workers[LP_WORKQUEUE_NUM_WORKERS];
+    int next_worker;
+#endif
 } lp_workqueue_t;
 
 /**
  * @brief Initialization the work queue.
  * @param lp_workqueue_t *wq that we want to initialize
- * @param int max_elements_inqueue how many items can we have in the queue
+ * @param int max_elements_inqueue how many items can we have in the queue, they're all allocated here
  * @return os ret return status
  */
 int _init_lp_workqueue(lp_workqueue_t *wq, int max_elements_inqueue);
 
+/**
+ * @brief Frees everything _init_lp_workqueue allocated
+ * @note Nothing can be using the workqueue anymore, worker threads included
+ */
+int _deinit_lp_workqueue(lp_workqueue_t *wq);
+
 /**
  * @brief Add a function to the workqueue
  * @param lp_workqueue_t* workqueue
@@ -57,10 +193,32 @@ int _lp_workqueue_add_func(lp_workqueue_t *wq, wq_func func, void *param, int in
  */
 int lp_workqueue_add_func(wq_func func, void *param, int interval_ms, lp_workqueue_func_node_t **ptr_node);
 
+/**
+ * @brief Picks what a periodic item does about missed periods, LP_WORKQUEUE_COALESCE by default
+ * @param lp_workqueue_t* workqueue
+ * @param lp_workqueue_func_node_t *pointer to the workqueue node
+ * @param lp_workqueue_policy_t policy
+ * @note Periods stay anchored to when the item was added, a slow callback or a busy loop doesn't push the schedule back
+ */
+int _lp_workqueue_set_policy(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node, lp_workqueue_policy_t policy);
+
+/**
+ * @brief Copies out a periodic item's lateness and jitter stats
+ * @param lp_workqueue_t* workqueue
+ * @param lp_workqueue_func_node_t *pointer to the workqueue node
+ * @param lp_workqueue_stats_t *stats filled in
+ */
+int _lp_workqueue_get_stats(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node, lp_workqueue_stats_t *stats);
+
+int lp_workqueue_set_policy(lp_workqueue_func_node_t *ptr_node, lp_workqueue_policy_t policy);
+int lp_workqueue_get_stats(lp_workqueue_func_node_t *ptr_node, lp_workqueue_stats_t *stats);
+
 /**
  * @brief Removes a workqueue element from the low priority workqueue
  * @param lp_workqueue_t* workqueue
  * @param lp_workqueue_func_node_t *pointer to the workqueue node
+ * @note An element that is queued on a worker or running gets freed once it's done, removing it again
+ * until then returns OS_RET_OK and does nothing
  */
 int _lp_workqueue_rm(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node);
 
@@ -70,14 +228,90 @@ int _lp_workqueue_rm(lp_workqueue_t *wq, lp_workqueue_func_node_t *ptr_node);
  */
 int lp_workqueue_rm(lp_workqueue_func_node_t *ptr_node);
 
+/**
+ * @brief Runs a function once, delay_ms from now
+ * @param lp_workqueue_t* workqueue
+ * @param wq_func function we want to run
+ * @param uint32_t delay_ms how long from now
+ * @param lp_workqueue_handle_t *handle filled in for cancelling or rescheduling it, can be NULL
+ */
+int _lp_workqueue_schedule_once(lp_workqueue_t *wq, wq_func func, void *param, uint32_t delay_ms, lp_workqueue_handle_t *handle);
+
+/**
+ * @brief Runs a function once, at a point in get_current_time_millis time
+ * @param lp_workqueue_t* workqueue
+ * @param wq_func function we want to run
+ * @param uint64_t at_ms when, anything already past runs on the next pass
+ * @param lp_workqueue_handle_t *handle filled in for cancelling or rescheduling it, can be NULL
+ */
+int _lp_workqueue_schedule_at(lp_workqueue_t *wq, wq_func func, void *param, uint64_t at_ms, lp_workqueue_handle_t *handle);
+
+/**
+ * @brief Cancels a scheduled item in O(1)
+ * @param lp_workqueue_t* workqueue
+ * @param lp_workqueue_handle_t *handle from schedule
+ * @return OS_RET_INVALID_PARAM if it already ran or was cancelled
+ * @note Fine to call from inside a callback, including the item's own. An item that's already running finishes
+ */
+int _lp_workqueue_cancel(lp_workqueue_t *wq, lp_workqueue_handle_t *handle);
+
+/**
+ * @brief Moves a scheduled item to delay_ms from now in O(1)
+ * @param lp_workqueue_t* workqueue
+ * @param lp_workqueue_handle_t *handle from schedule
+ * @param uint32_t delay_ms how long from now
+ * @return OS_RET_INVALID_PARAM if it already ran or was cancelled
+ * @note Rescheduling a one shot from inside it's own callback arms it again
+ */
+int _lp_workqueue_reschedule(lp_workqueue_t *wq, lp_workqueue_handle_t *handle, uint32_t delay_ms);
+
+int lp_workqueue_schedule_once(wq_func func, void *param, uint32_t delay_ms, lp_workqueue_handle_t *handle);
+int lp_workqueue_schedule_at(wq_func func, void *param, uint64_t at_ms, lp_workqueue_handle_t *handle);
+int lp_workqueue_cancel(lp_workqueue_handle_t *handle);
+int lp_workqueue_reschedule(lp_workqueue_handle_t *handle, uint32_t delay_ms);
+
 /**
  * @brief Run this in the function you want to loop through your low priority function
  * @param lp_workqueue_t* workqueue
+ * @note Only runs the items that are due, everything else is left alone
  */
 int _lp_workqueue_loop(lp_workqueue_t *wq);
 
+/**
+ * @brief Blocks until the next item is due, or until something is added or rescheduled to before that
+ * @param lp_workqueue_t* workqueue
+ * @note Waits indefinitely on an empty workqueue. Call _lp_workqueue_loop after it returns
+ */
+int _lp_workqueue_wait(lp_workqueue_t *wq);
+
+/**
+ * @brief When the wheel next has something to do
+ * @param lp_workqueue_t* workqueue
+ * @param uint64_t *next_ms set to the soonest deadline or earlier, in get_current_time_millis time
+ * @return OS_RET_LIST_EMPTY if nothing is queued
+ */
+int _lp_workqueue_next_ms(lp_workqueue_t *wq, uint64_t *next_ms);
+
+#if LP_WORKQUEUE_NUM_WORKERS > 0
+/**
+ * @brief Runs due items handed to one worker, stealing from the others when it runs dry. Never returns unless something breaks
+ * @param lp_workqueue_t* workqueue
+ * @param int worker index, 0 to LP_WORKQUEUE_NUM_WORKERS - 1
+ * @note An item only goes back on the wheel once it's callback returns, so it never runs on two workers at once
+ */
+int _lp_workqueue_worker(lp_workqueue_t *wq, int worker);
+
+/**
+ * @brief Worker thread for the module level workqueue
+ * @param parameters worker index, cast to a pointer. NULL is worker 0
+ */
+void lp_workqueue_worker_thread(void *parameters);
+#endif
+
 /**
  * @brief Initialization of the lpworkqueue thread
+ * @note Sized by LP_WORKQUEUE_MAX_ITEMS. If it fails, the lp_workqueue_* calls return OS_RET_NOT_INITIALIZED
+ * and the workqueue threads exit straight away
  */
 void lp_workqueue_init(void *parameters);
 
@@ -86,6 +320,18 @@ void lp_workqueue_init(void *parameters);
  */
 void lp_workqueue_thread(void *parameters);
 
+#ifdef LP_WORKQUEUE_BENCHMARK
+/**
+ * @brief Times scheduling, expiry and cancellation with 10k and 100k staggered one shots, printed with os_println
+ */
+void lp_workqueue_benchmark(void);
+#endif
+
+/**
+ * @brief Low priority workqueue testing
+ */
+int lp_workqueue_unit_test(void);
+
 /**
  * @brief Tests out our low priority management thread
  */
@@ -15,7 +15,10 @@
 #define circular_println(e...) void(e)
 #endif
 
-int safe_circular_queue_init(safe_circular_queue_t *queue, int num_elements, size_t element_size)
+/**
+ * @brief Shared by both init functions, mallocs our storage if we weren't given any
+ */
+static int safe_circular_queue_setup(safe_circular_queue_t *queue, void *storage, int num_elements, size_t element_size)
 {
     int ret;
     if (queue == NULL)
@@ -74,7 +77,8 @@ int safe_circular_queue_init(safe_circular_queue_t *queue, int num_elements, siz
     // Align memory to closest 32 bit integer(assuming we are a 32bit system for now...  cross this bridge later heh)
     element_size = align_up(element_size, 4);
     int total_memory = element_size * num_elements;
-    queue->data_ptr = malloc(total_memory);
+    queue->static_storage = storage != NULL;
+    queue->data_ptr = storage != NULL ? storage : malloc(total_memory);
 
     // memset(queue->data_ptr, 0, element_size * num_elements);
     if (queue->data_ptr == NULL)
@@ -94,6 +98,21 @@ int safe_circular_queue_init(safe_circular_queue_t *queue, int num_elements, siz
     return OS_RET_OK;
 }
 
+int safe_circular_queue_init(safe_circular_queue_t *queue, int num_elements, size_t element_size)
+{
+    return safe_circular_queue_setup(queue, NULL, num_elements, element_size);
+}
+
+int safe_circular_queue_init_static(safe_circular_queue_t *queue, void *storage, int num_elements, size_t element_size)
+{
+    if (storage == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    return safe_circular_queue_setup(queue, storage, num_elements, element_size);
+}
+
 int safe_circular_enqueue(safe_circular_queue_t *queue, size_t element_size, void *element)
 {
     if (queue == NULL)
@@ -112,11 +131,6 @@ int safe_circular_enqueue(safe_circular_queue_t *queue, size_t element_size, voi
         return OS_RET_INVALID_PARAM;
     }
 
-    if (queue->num_elements_in_queue >= queue->num_elements)
-    {
-        return OS_RET_LOW_MEM_ERROR;
-    }
-
     // Wraparound queue function
     int ret = os_mut_entry_wait_indefinite(&queue->queue_mutx);
     if (ret != OS_RET_OK)
@@ -124,6 +138,13 @@ int safe_circular_enqueue(safe_circular_queue_t *queue, size_t element_size, voi
         return ret;
     }
 
+    // Checked under the lock, multiple producers can race for the last slot
+    if (queue->num_elements_in_queue >= queue->num_elements)
+    {
+        os_mut_exit(&queue->queue_mutx);
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
     circular_println("Segment memory to send");
     void *data_ptr = (void *)align_up((intptr_t)queue->data_ptr + (queue->element_size * queue->head), 4);
     memcpy(data_ptr, element, queue->element_size);
@@ -179,11 +200,9 @@ int safe_circular_enqueue_notimeout(safe_circular_queue_t *queue, size_t element
 {
     circular_println("Enqueue item...");
     int ret = safe_circular_enqueue(queue, element_size, element);
-    if (ret == OS_RET_OK)
-    {
-        return ret;
-    }
-    else if (ret == OS_RET_LOW_MEM_ERROR)
+
+    // The signal can be left over from an older dequeue, so keep waiting until we actually fit
+    while (ret == OS_RET_LOW_MEM_ERROR)
     {
         // Try to acquire the lock before we wait
         // That way it blocks until someone unlocks
@@ -202,12 +221,94 @@ int safe_circular_enqueue_notimeout(safe_circular_queue_t *queue, size_t element
         }
 
         circular_println("Block complete, enqueue element");
-        return safe_circular_enqueue(queue, element_size, element);
+        ret = safe_circular_enqueue(queue, element_size, element);
+
+        // We cleared the signal for everyone, so pass it on if there is still room for another blocked producer
+        if (ret == OS_RET_OK && queue->num_elements_in_queue < queue->num_elements)
+        {
+            os_setbits_signal(&queue->enqueue_signal, 1);
+        }
     }
-    else
+
+    return ret;
+}
+
+int safe_circular_enqueue_batch(safe_circular_queue_t *queue, size_t element_size, void *elements, int num_elements)
+{
+    if (queue == NULL || elements == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (element_size != queue->element_size || num_elements <= 0 || num_elements > queue->num_elements)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    int ret = os_mut_entry_wait_indefinite(&queue->queue_mutx);
+    if (ret != OS_RET_OK)
+    {
+        return ret;
+    }
+
+    // All or nothing, so nobody else's elements end up in between ours
+    if (queue->num_elements - queue->num_elements_in_queue < num_elements)
+    {
+        os_mut_exit(&queue->queue_mutx);
+        return OS_RET_LOW_MEM_ERROR;
+    }
+
+    for (int n = 0; n < num_elements; n++)
+    {
+        void *data_ptr = (void *)align_up((intptr_t)queue->data_ptr + (queue->element_size * queue->head), 4);
+        memcpy(data_ptr, (uint8_t *)elements + (element_size * n), element_size);
+
+        queue->head++;
+        if (queue->head == queue->num_elements)
+        {
+            queue->head = 0;
+        }
+    }
+    queue->num_elements_in_queue += num_elements;
+
+    ret = os_mut_exit(&queue->queue_mutx);
+    if (ret != OS_RET_OK)
     {
         return ret;
     }
+
+    // One wakeup for the whole batch
+    return os_setbits_signal(&queue->dequeue_signal, 1);
+}
+
+int safe_circular_enqueue_batch_notimeout(safe_circular_queue_t *queue, size_t element_size, void *elements, int num_elements)
+{
+    int ret = safe_circular_enqueue_batch(queue, element_size, elements, num_elements);
+
+    while (ret == OS_RET_LOW_MEM_ERROR)
+    {
+        ret = os_waitbits_indefinite(&queue->enqueue_signal, 1);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+
+        ret = os_clearbits(&queue->enqueue_signal, 1);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+
+        ret = safe_circular_enqueue_batch(queue, element_size, elements, num_elements);
+
+        // Same as safe_circular_enqueue_notimeout, pass the signal on if there is still room
+        if (ret == OS_RET_OK && queue->num_elements_in_queue < queue->num_elements)
+        {
+            os_setbits_signal(&queue->enqueue_signal, 1);
+        }
+    }
+
+    return ret;
 }
 
 int safe_circular_dequeue(safe_circular_queue_t *queue, size_t element_size, void *element)
@@ -256,12 +357,9 @@ int safe_circular_dequeue(safe_circular_queue_t *queue, size_t element_size, voi
 int safe_circular_dequeue_notimeout(safe_circular_queue_t *queue, size_t element_size, void *element)
 {
     int ret = safe_circular_dequeue(queue, element_size, element);
-    if (ret == OS_RET_OK)
-    {
-        circular_println("List has item");
-        return ret;
-    }
-    else if (ret == OS_RET_LIST_EMPTY)
+
+    // The signal can be left over from an older enqueue, so keep waiting until we actually get an element
+    while (ret == OS_RET_LIST_EMPTY)
     {
         circular_println("List is empty.. waiting");
         // Try to acquire the lock before we wait
@@ -277,12 +375,16 @@ int safe_circular_dequeue_notimeout(safe_circular_queue_t *queue, size_t element
         {
             return ret;
         }
-        return safe_circular_dequeue(queue, element_size, element);
-    }
-    else
-    {
-        return ret;
+        ret = safe_circular_dequeue(queue, element_size, element);
+
+        // We cleared the signal for everyone, so pass it on if there is still data for another blocked consumer
+        if (ret == OS_RET_OK && queue->num_elements_in_queue > 0)
+        {
+            os_setbits_signal(&queue->dequeue_signal, 1);
+        }
     }
+
+    return ret;
 }
 
 int safe_circular_dequeue_timeout(safe_circular_queue_t *queue, size_t element_size, void *element, uint32_t timeout_ms)
@@ -316,6 +418,105 @@ int safe_circular_dequeue_timeout(safe_circular_queue_t *queue, size_t element_s
     }
 }
 
+int safe_circular_dequeue_batch_timeout(safe_circular_queue_t *queue, size_t element_size, void *elements, int max_elements, uint32_t timeout_ms)
+{
+    if (queue == NULL || elements == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    if (element_size != queue->element_size || max_elements <= 0)
+    {
+        return OS_RET_INVALID_PARAM;
+    }
+
+    uint64_t deadline_ms = get_current_time_millis() + timeout_ms;
+    for (;;)
+    {
+        int ret = os_mut_entry_wait_indefinite(&queue->queue_mutx);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+
+        int count = 0;
+        while (count < max_elements && queue->num_elements_in_queue > 0)
+        {
+            void *data_ptr = (void *)align_up((intptr_t)queue->data_ptr + (queue->element_size * queue->tail), 4);
+            memcpy((uint8_t *)elements + (element_size * count), data_ptr, element_size);
+
+            queue->tail++;
+            queue->num_elements_in_queue--;
+            if (queue->tail == queue->num_elements)
+                queue->tail = 0;
+            count++;
+        }
+        bool more = queue->num_elements_in_queue > 0;
+
+        ret = os_mut_exit(&queue->queue_mutx);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+
+        if (count > 0)
+        {
+            // Someone else might be blocked on the data we left behind
+            if (more)
+            {
+                os_setbits_signal(&queue->dequeue_signal, 1);
+            }
+            os_setbits_signal(&queue->enqueue_signal, 1);
+            return count;
+        }
+
+        if (timeout_ms == 0)
+        {
+            return 0;
+        }
+
+        circular_println("List is empty.. waiting");
+        if (timeout_ms == SAFE_CIRCULAR_WAIT_FOREVER)
+        {
+            ret = os_waitbits_indefinite(&queue->dequeue_signal, 1);
+        }
+        else
+        {
+            uint64_t now_ms = get_current_time_millis();
+            if (now_ms >= deadline_ms)
+            {
+                return 0;
+            }
+            ret = os_waitbits(&queue->dequeue_signal, 1, deadline_ms - now_ms);
+        }
+
+        if (ret == OS_RET_TIMEOUT)
+        {
+            return 0;
+        }
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+
+        ret = os_clearbits(&queue->dequeue_signal, 1);
+        if (ret != OS_RET_OK)
+        {
+            return ret;
+        }
+    }
+}
+
+int safe_circular_queue_count(safe_circular_queue_t *queue)
+{
+    if (queue == NULL)
+    {
+        return OS_RET_NULL_PTR;
+    }
+
+    return __atomic_load_n(&queue->num_elements_in_queue, __ATOMIC_ACQUIRE);
+}
+
 int safe_circular_deinit(safe_circular_queue_t *queue)
 {
     if (queue == NULL)
@@ -332,7 +533,11 @@ int safe_circular_deinit(safe_circular_queue_t *queue)
         return OS_RET_INT_ERR;
     }
 
-    free(queue->data_ptr);
+    if (queue->static_storage == false)
+    {
+        free(queue->data_ptr);
+    }
+    queue->data_ptr = NULL;
     queue->head = 0;
     queue->tail = 0;
     queue->status = OS_STATUS_UNINITIALIZED;
@@ -456,9 +661,64 @@ int safe_circular_queue_unit_test(void)
             assert_testcase_equal("dequeue n_four_test", 0, 1);
         }
     }
+    for (int n = 0; n < 10; n++)
+    {
+        src.n_one = n;
+        safe_circular_enqueue(&queue, sizeof(src), &src);
+    }
+
+    test_struct_t batch[16];
+    ret = safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 4, 0);
+    assert_testcase_equal("dequeue batch capped at max", ret, 4);
+    assert_testcase_equal("dequeue batch order", batch[3].n_one, 3);
+
+    ret = safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 16, 0);
+    assert_testcase_equal("dequeue batch remaining", ret, 6);
+    assert_testcase_equal("dequeue batch order", batch[5].n_one, 9);
+    assert_testcase_equal("queue count after batch", safe_circular_queue_count(&queue), 0);
+
+    ret = safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 16, 10);
+    assert_testcase_equal("dequeue batch timeout", ret, 0);
+
     ret = safe_circular_deinit(&queue);
     assert_testcase_equal("enqueue no timeout ret status", ret, OS_RET_OK);
 
+    test_struct_t group[3];
+    for (int n = 0; n < 3; n++)
+    {
+        group[n].n_one = 100 + n;
+    }
+    ret = safe_circular_queue_init(&queue, 4, sizeof(test_struct_t));
+    safe_circular_enqueue(&queue, sizeof(src), &src);
+    safe_circular_enqueue(&queue, sizeof(src), &src);
+    ret = safe_circular_enqueue_batch(&queue, sizeof(src), group, 3);
+    assert_testcase_equal("enqueue batch all or nothing", ret, OS_RET_LOW_MEM_ERROR);
+    assert_testcase_equal("enqueue batch left queue alone", safe_circular_queue_count(&queue), 2);
+    safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 2, 0);
+    ret = safe_circular_enqueue_batch(&queue, sizeof(src), group, 3);
+    assert_testcase_equal("enqueue batch ret status", ret, OS_RET_OK);
+    ret = safe_circular_enqueue_batch(&queue, sizeof(src), group, 5);
+    assert_testcase_equal("enqueue batch bigger than queue", ret, OS_RET_INVALID_PARAM);
+    ret = safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 16, 0);
+    assert_testcase_equal("enqueue batch count", ret, 3);
+    assert_testcase_equal("enqueue batch order", batch[2].n_one, 102);
+    safe_circular_deinit(&queue);
+
+    static uint32_t static_storage[SAFE_CIRCULAR_STORAGE_SIZE(4, sizeof(test_struct_t)) / sizeof(uint32_t)];
+    ret = safe_circular_queue_init_static(&queue, static_storage, 4, sizeof(test_struct_t));
+    assert_testcase_equal("static init ret status", ret, OS_RET_OK);
+    for (int n = 0; n < 5; n++)
+    {
+        src.n_one = n;
+        ret = safe_circular_enqueue(&queue, sizeof(src), &src);
+    }
+    assert_testcase_equal("static queue full", ret, OS_RET_LOW_MEM_ERROR);
+    ret = safe_circular_dequeue_batch_timeout(&queue, sizeof(src), batch, 16, 0);
+    assert_testcase_equal("static queue dequeue", ret, 4);
+    assert_testcase_equal("static queue order", batch[3].n_one, 3);
+    ret = safe_circular_deinit(&queue);
+    assert_testcase_equal("static deinit ret status", ret, OS_RET_OK);
+
     unit_testcase_end();
     return OS_RET_OK;
 }
\ No newline at end of file
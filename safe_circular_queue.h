@@ -6,6 +6,8 @@
 #include "stdint.h"
 #include "os_status.h"
 
+#define SAFE_CIRCULAR_WAIT_FOREVER (UINT32_MAX)
+
 typedef struct safe_circular_queue_t
 {
     os_mut_t queue_mutx;
@@ -21,8 +23,16 @@ typedef struct safe_circular_queue_t
     // Signals for enqueuing and dequeuing mutexes
     os_setbits_t enqueue_signal;
     os_setbits_t dequeue_signal;
+
+    // Storage was handed to us by safe_circular_queue_init_static, so deinit doesn't free it
+    bool static_storage;
 } safe_circular_queue_t;
 
+/**
+ * @brief Bytes of storage a queue of num_elements elements needs with safe_circular_queue_init_static
+ */
+#define SAFE_CIRCULAR_STORAGE_SIZE(num_elements, element_size) ((num_elements) * (((element_size) + 3) & ~3))
+
 /**
  * @brief Threadsafe Circular Queue Initialization
  * @param safe_circular_queue_t *pointer to queue descripter structure
@@ -31,6 +41,27 @@ typedef struct safe_circular_queue_t
  */
 int safe_circular_queue_init(safe_circular_queue_t *queue, int num_elements, size_t element_size);
 
+/**
+ * @brief Threadsafe Circular Queue Initialization on top of storage we don't have to malloc
+ * @param void *storage at least SAFE_CIRCULAR_STORAGE_SIZE(num_elements, element_size) bytes, 4 byte aligned
+ * @note Meant for statically allocated queues, storage has to outlive the queue
+ */
+int safe_circular_queue_init_static(safe_circular_queue_t *queue, void *storage, int num_elements, size_t element_size);
+
+/**
+ * @brief Enqueues a group of elements back to back with a single lock and a single wakeup
+ * @param void *elements num_elements elements laid out in an array
+ * @return OS_RET_LOW_MEM_ERROR if they don't all fit, in which case nothing got enqueued
+ * @note No other producer's elements can end up in between the group
+ */
+int safe_circular_enqueue_batch(safe_circular_queue_t *queue, size_t element_size, void *elements, int num_elements);
+
+/**
+ * @brief Same as safe_circular_enqueue_batch, but blocks until there is room for the whole group
+ * @note Groups bigger than the queue can never fit and get OS_RET_INVALID_PARAM
+ */
+int safe_circular_enqueue_batch_notimeout(safe_circular_queue_t *queue, size_t element_size, void *elements, int num_elements);
+
 /**
  * @brief Theadsafe circular queue enque function
  * @param safe_circular_queue_t *pointer to queue descripter structure
@@ -87,6 +118,24 @@ int safe_circular_dequeue_notimeout(safe_circular_queue_t *queue, size_t element
  */
 int safe_circular_dequeue_timeout(safe_circular_queue_t *queue, size_t element_size, void *element, uint32_t timeout_ms);
 
+/**
+ * @brief Theadsafe circular queue batch deque function, takes the lock once for the whole batch
+ * @param safe_circular_queue_t *pointer to queue descripter structure
+ * @param size_t element_size size of memory space of each element being copied to
+ * @param void *elements pointer to an array of at least max_elements elements being copied into
+ * @param int max_elements most elements we want out of the queue
+ * @param uint32_t timeout_ms how long to wait for the first element, 0 doesn't wait, SAFE_CIRCULAR_WAIT_FOREVER waits indefinitely
+ * @return number of elements dequeued(0 on timeout), or a negative error
+ */
+int safe_circular_dequeue_batch_timeout(safe_circular_queue_t *queue, size_t element_size, void *elements, int max_elements, uint32_t timeout_ms);
+
+/**
+ * @brief How many elements are sitting in the queue right now
+ * @param safe_circular_queue_t *pointer to queue descripter structure
+ * @note Atomic read, no lock taken
+ */
+int safe_circular_queue_count(safe_circular_queue_t *queue);
+
 /**
  * @brief Deconstructs the circular queue
  */